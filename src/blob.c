@@ -0,0 +1,354 @@
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <blob.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <error.h>
+#include <libfdt.h>
+
+/** Active mapping policy, see enum MAP_POLICY */
+static unsigned mapPolicy;
+
+/** Set the policy for mapping blobs into memory.
+ * \param policy bitwise or of MAP_POLICY_* flags
+ */
+void setMapPolicy(unsigned policy)
+{
+	mapPolicy = policy;
+}
+
+/** Allocate an anonymous buffer for reading a file into.
+ * \param size size of the buffer
+ * \return the buffer or MAP_FAILED
+ */
+static void * allocBuffer(size_t size)
+{
+	void * buf = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	/* only a hint: fails harmlessly if THP is not available */
+	if (buf != MAP_FAILED && (mapPolicy & MAP_POLICY_HUGEPAGES))
+		madvise(buf, size, MADV_HUGEPAGE);
+	return buf;
+}
+
+/** Open a file for reading.
+ * \param filename file to be opened, "-" for stdin
+ * \return file descriptor or -1 in case of an error
+ */
+static int openInput(const char * filename)
+{
+	int fd;
+	if (!strcmp(filename, "-"))
+		fd = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0);
+	else
+		fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		error(0, errno, "Could not open '%s'", filename);
+	return fd;
+}
+
+/** Read exactly the given number of bytes
+ * \param fd file descriptor
+ * \param buf buffer to be filled
+ * \param len number of bytes
+ * \param filename file name, for diagnostics
+ * \return true on success, false otherwise
+ */
+static bool readFully(int fd, void * buf, size_t len, const char * filename)
+{
+	while (len) {
+		ssize_t res = read(fd, buf, len);
+		if (res < 0 && errno == EINTR)
+			continue;
+		if (res < 0) {
+			error(0, errno, "Could not read '%s'", filename);
+			return false;
+		}
+		if (!res) {
+			error(0, 0, "FDT invalid: unexpected end of '%s'", filename);
+			return false;
+		}
+		buf = (char *)buf + res;
+		len -= res;
+	}
+	return true;
+}
+
+/** Read a device tree blob from a stream (e.g. a pipe).
+ *  The header tells the total size, so the blob is read into one exactly
+ *  sized anonymous mapping, without reallocations.
+ * \param fd file descriptor
+ * \param filename file name, for diagnostics
+ * \param blob blob to be filled
+ * \return true on success, false otherwise
+ */
+static bool readBlob(int fd, const char * filename, struct Blob * blob)
+{
+	struct fdt_header header;
+	if (!readFully(fd, &header, sizeof header, filename))
+		return false;
+	if (fdt_magic(&header) != FDT_MAGIC ||
+		fdt_totalsize(&header) < sizeof header) {
+		error(0, 0, "FDT invalid: bad header in '%s'", filename);
+		return false;
+	}
+
+	size_t size = fdt_totalsize(&header);
+	void * fdt = allocBuffer(size);
+	if (fdt == MAP_FAILED) {
+		error(0, errno, "Could not allocate %zu bytes for '%s'", size,
+			filename);
+		return false;
+	}
+	memcpy(fdt, &header, sizeof header);
+	if (!readFully(fd, (char *)fdt + sizeof header, size - sizeof header,
+		filename)) {
+		munmap(fdt, size);
+		return false;
+	}
+
+	blob->filename = filename;
+	blob->fdt = fdt;
+	blob->size = size;
+	blob->used = size;
+	return true;
+}
+
+/** Read a whole stream (e.g. a pipe) into an anonymous mapping.
+ *  If the size is unknown in advance, the mapping grows while reading.
+ * \param fd file descriptor
+ * \param hint expected size, 0 if unknown
+ * \param filename file name, for diagnostics
+ * \param blob blob to be filled
+ * \return true on success, false otherwise
+ */
+static bool readStream(int fd, size_t hint, const char * filename,
+	struct Blob * blob)
+{
+	/* one more byte, so EOF is seen without growing the mapping */
+	size_t capacity = hint ? hint + 1 : 1 << 20;
+	size_t size = 0;
+	void * data = allocBuffer(capacity);
+	if (data == MAP_FAILED) {
+		error(0, errno, "Could not allocate memory for '%s'", filename);
+		return false;
+	}
+
+	while (true) {
+		if (size == capacity) {
+			void * grown = mremap(data, capacity, capacity * 2,
+				MREMAP_MAYMOVE);
+			if (grown == MAP_FAILED) {
+				error(0, errno, "Could not allocate memory for '%s'",
+					filename);
+				munmap(data, capacity);
+				return false;
+			}
+			data = grown;
+			capacity *= 2;
+		}
+		ssize_t res = read(fd, (char *)data + size, capacity - size);
+		if (res < 0 && errno == EINTR)
+			continue;
+		if (res < 0) {
+			error(0, errno, "Could not read '%s'", filename);
+			munmap(data, capacity);
+			return false;
+		}
+		if (!res)
+			break;
+		size += res;
+	}
+
+	if (size < sizeof(struct fdt_header)) {
+		error(0, 0, "FDT invalid: cannot read header of '%s'", filename);
+		munmap(data, capacity);
+		return false;
+	}
+
+	blob->filename = filename;
+	blob->fdt = data;
+	/* unmapping the whole mapping is fine, the rest is still zero */
+	blob->size = capacity;
+	blob->used = size;
+	return true;
+}
+
+/** Map a regular file into memory.
+ * \param fd file descriptor
+ * \param size size of the file
+ * \param filename file name, for diagnostics
+ * \param blob blob to be filled
+ * \return true on success, false otherwise
+ */
+static bool mapRegular(int fd, size_t size, const char * filename,
+	struct Blob * blob)
+{
+	if (size < sizeof(struct fdt_header)) {
+		error(0, 0, "FDT invalid: cannot read header of '%s'", filename);
+		return false;
+	}
+
+	/* map it into memory, prefaulting it if requested */
+	int flags = MAP_PRIVATE;
+	if (mapPolicy & MAP_POLICY_PREFETCH)
+		flags |= MAP_POPULATE;
+	void * fdt = mmap(NULL, size, PROT_READ, flags, fd, 0);
+	if (fdt == MAP_FAILED) {
+		error(0, errno, "Could not mmap '%s'", filename);
+		return false;
+	}
+	/* a lighter alternative: start reading ahead, without waiting for it
+	 * (pointless after prefaulting, the pages are there already)
+	 */
+	if ((mapPolicy & MAP_POLICY_READAHEAD) &&
+		!(mapPolicy & MAP_POLICY_PREFETCH)) {
+		madvise(fdt, size, MADV_SEQUENTIAL);
+		madvise(fdt, size, MADV_WILLNEED);
+	}
+
+	blob->filename = filename;
+	blob->fdt = fdt;
+	blob->size = size;
+	blob->used = size;
+	return true;
+}
+
+/** Keep the file descriptor of a blob if its page cache is to be dropped
+ *  on close, otherwise close it.
+ * \param fd file descriptor
+ * \param st status of the file
+ * \param opened whether the blob was opened successfully
+ * \param blob blob to keep the file descriptor in
+ */
+static void keepInput(int fd, const struct stat * st, bool opened,
+	struct Blob * blob)
+{
+	if (opened && S_ISREG(st->st_mode) && (mapPolicy & MAP_POLICY_DROP)) {
+		blob->fd = fd;
+		return;
+	}
+	if (opened)
+		blob->fd = -1;
+	close(fd);
+}
+
+/** Map a file into memory without validating its contents.
+ *  Files which cannot be mapped (e.g. pipes) are read into memory.
+ * \param filename file to be mapped, "-" for stdin
+ * \param blob blob to be filled
+ * \return true on success, false otherwise
+ * \note In case of an error, the error is printed to stderr.
+ */
+bool mapFile(const char * filename, struct Blob * blob)
+{
+	int fd = openInput(filename);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		error(0, errno, "Could not stat '%s'", filename);
+		close(fd);
+		return false;
+	}
+
+	bool res;
+	if (!S_ISREG(st.st_mode))
+		res = readStream(fd, 0, filename, blob);
+	else if (mapPolicy & MAP_POLICY_HUGEPAGES)
+		res = readStream(fd, st.st_size, filename, blob);
+	else
+		res = mapRegular(fd, st.st_size, filename, blob);
+	keepInput(fd, &st, res, blob);
+	return res;
+}
+
+/** Open a device tree blob, either mapped or read into memory.
+ * \param filename file to be opened, "-" for stdin
+ * \param blob blob to be filled
+ * \param copy whether to read a regular file instead of mapping it
+ * \return true on success, false otherwise
+ */
+static bool loadFile(const char * filename, struct Blob * blob, bool copy)
+{
+	int fd = openInput(filename);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		error(0, errno, "Could not stat '%s'", filename);
+		close(fd);
+		return false;
+	}
+
+	bool res;
+	if (!S_ISREG(st.st_mode) || copy)
+		res = readBlob(fd, filename, blob);
+	else
+		res = mapRegular(fd, st.st_size, filename, blob);
+	keepInput(fd, &st, res, blob);
+	if (!res)
+		return false;
+
+	if (S_ISREG(st.st_mode) && (off_t)fdt_totalsize(blob->fdt) != st.st_size) {
+		error(0, 0, "FDT invalid: size mismatch in '%s'", filename);
+		closeBlob(blob);
+		return false;
+	}
+	return true;
+}
+
+/** Open a device tree blob and map it into memory.
+ *  Blobs which cannot be mapped (e.g. from a pipe) are read into memory.
+ * \param filename file to be opened, "-" for stdin
+ * \param blob blob to be filled
+ * \return true on success, false otherwise
+ * \note In case of an error, the error is printed to stderr.
+ */
+bool openBlob(const char * filename, struct Blob * blob)
+{
+	return loadFile(filename, blob, mapPolicy & MAP_POLICY_HUGEPAGES);
+}
+
+/** Read a device tree blob into a private buffer. Unlike a private file
+ *  mapping, which still follows the file where it was not written to, the
+ *  buffer is a snapshot: rewriting or truncating the file later does not
+ *  affect it.
+ * \param filename file to be read, "-" for stdin
+ * \param blob blob to be filled
+ * \return true on success, false otherwise
+ * \note In case of an error, the error is printed to stderr.
+ */
+bool loadBlob(const char * filename, struct Blob * blob)
+{
+	return loadFile(filename, blob, true);
+}
+
+/** Unmap a device tree blob.
+ *  If requested, the file's pages are evicted from the page cache, so bulk
+ *  runs over many files do not push out everything else.
+ * \param blob blob to be closed
+ */
+void closeBlob(struct Blob * blob)
+{
+	munmap(blob->fdt, blob->size);
+	if (blob->fd >= 0) {
+		posix_fadvise(blob->fd, 0, 0, POSIX_FADV_DONTNEED);
+		close(blob->fd);
+		blob->fd = -1;
+	}
+	blob->fdt = NULL;
+	blob->size = 0;
+	blob->used = 0;
+}
@@ -0,0 +1,43 @@
+#ifndef _BLOB_H
+#define _BLOB_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/** Policies for mapping blobs into memory, may be combined */
+enum MAP_POLICY {
+	/** Prefault the mapping */
+	MAP_POLICY_PREFETCH = 1 << 0,
+	/** Read files into anonymous buffers backed by transparent huge pages */
+	MAP_POLICY_HUGEPAGES = 1 << 1,
+	/** Evict the file from the page cache when closing it */
+	MAP_POLICY_DROP = 1 << 2,
+	/** Hint sequential access and start reading ahead, without prefaulting */
+	MAP_POLICY_READAHEAD = 1 << 3
+};
+
+/** A flattened device tree blob mapped into memory */
+struct Blob {
+	/** file name, for diagnostics */
+	const char * filename;
+	/** start of the mapping */
+	void * fdt;
+	/** size of the mapping */
+	size_t size;
+	/** size of the contents, may be less than the mapping for streams */
+	size_t used;
+	/** file descriptor kept for dropping the page cache, -1 otherwise */
+	int fd;
+};
+
+void setMapPolicy(unsigned policy);
+
+bool mapFile(const char * filename, struct Blob * blob);
+
+bool openBlob(const char * filename, struct Blob * blob);
+
+bool loadBlob(const char * filename, struct Blob * blob);
+
+void closeBlob(struct Blob * blob);
+
+#endif
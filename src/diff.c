@@ -0,0 +1,237 @@
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <diff.h>
+#include <hash.h>
+#include <query.h>
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <stdio.h>
+#include <assert.h>
+#include <error.h>
+#include <libfdt.h>
+
+/** State of a running diff */
+struct Diff {
+	/** old device tree */
+	struct HashedFdt a;
+	/** new device tree */
+	struct HashedFdt b;
+	/** nodes of the new tree which already have a partner in the old one */
+	bool * paired;
+	/** optional: nodes of the old tree matching the filter */
+	bool * markedA;
+	/** optional: nodes of the new tree matching the filter */
+	bool * markedB;
+	/** path of the current node */
+	char path[PATH_MAX];
+	/** number of differences found */
+	int differences;
+};
+
+/** Report an added or removed subtree.
+ *  Without a filter, only the root of the subtree is reported. With a
+ *  filter, each topmost node matching the filter is reported.
+ * \param diff diff state
+ * \param hashed tree containing the subtree
+ * \param marked nodes matching the filter, NULL if there is no filter
+ * \param index index of the root node of the subtree
+ * \param len length of the path of the root node
+ * \param sign '+' for added, '-' for removed subtrees
+ */
+static void reportSubtree(struct Diff * diff, const struct HashedFdt * hashed,
+	const bool * marked, int index, size_t len, char sign)
+{
+	if (!marked || marked[index]) {
+		printf("%c %.*s\n", sign, (int)len, diff->path);
+		diff->differences++;
+		return;
+	}
+
+	for (int child = hashed->nodes[index].firstChild; child >= 0;
+		child = hashed->nodes[child].nextSibling) {
+		size_t childLen = appendHashedName(hashed, child, diff->path, len,
+			sizeof diff->path);
+		reportSubtree(diff, hashed, marked, child, childLen, sign);
+	}
+}
+
+/** Report the differences of the properties of two nodes.
+ * \param diff diff state
+ * \param offsetA offset of the node in the old tree
+ * \param offsetB offset of the node in the new tree
+ * \param len length of the path of the nodes
+ */
+static void diffProperties(struct Diff * diff, int offsetA, int offsetB,
+	size_t len)
+{
+	const void * fdtA = diff->a.fdt;
+	const void * fdtB = diff->b.fdt;
+
+	/* removed or changed properties */
+	for (int prop = fdt_first_property_offset(fdtA, offsetA); prop >= 0;
+		prop = fdt_next_property_offset(fdtA, prop)) {
+		const char * name;
+		int lenA, lenB;
+		const void * valA = fdt_getprop_by_offset(fdtA, prop, &name, &lenA);
+		const void * valB = fdt_getprop(fdtB, offsetB, name, &lenB);
+		char sign;
+		if (!valB)
+			sign = '-';
+		else if (lenA != lenB || memcmp(valA, valB, lenA))
+			sign = '~';
+		else
+			continue;
+		printf("%c %.*s[%s]\n", sign, (int)len, diff->path, name);
+		diff->differences++;
+	}
+
+	/* added properties */
+	for (int prop = fdt_first_property_offset(fdtB, offsetB); prop >= 0;
+		prop = fdt_next_property_offset(fdtB, prop)) {
+		const char * name;
+		fdt_getprop_by_offset(fdtB, prop, &name, NULL);
+		if (fdt_getprop(fdtA, offsetA, name, NULL))
+			continue;
+		printf("+ %.*s[%s]\n", (int)len, diff->path, name);
+		diff->differences++;
+	}
+}
+
+/** Diff two nodes which have the same path, skipping identical subtrees.
+ * \param diff diff state
+ * \param indexA index of the node in the old tree
+ * \param indexB index of the node in the new tree
+ * \param len length of the path of the nodes
+ */
+static void diffNodes(struct Diff * diff, int indexA, int indexB, size_t len)
+{
+	const struct HashedNode * nodeA = &diff->a.nodes[indexA];
+	const struct HashedNode * nodeB = &diff->b.nodes[indexB];
+
+	/* identical subtrees: nothing to report */
+	if (nodeA->hash == nodeB->hash)
+		return;
+
+	if (!diff->markedA || diff->markedA[indexA] || diff->markedB[indexB])
+		diffProperties(diff, nodeA->offset, nodeB->offset, len);
+
+	/* pair the children by name */
+	int slot = nodeB->firstChild;
+	for (int childA = nodeA->firstChild; childA >= 0;
+		childA = diff->a.nodes[childA].nextSibling) {
+		int childB = pairHashedChild(&diff->a, childA, &diff->b, indexB, slot,
+			diff->paired);
+		if (slot >= 0)
+			slot = diff->b.nodes[slot].nextSibling;
+
+		size_t childLen = appendHashedName(&diff->a, childA, diff->path, len,
+			sizeof diff->path);
+		if (childB >= 0) {
+			diff->paired[childB] = true;
+			diffNodes(diff, childA, childB, childLen);
+		} else {
+			reportSubtree(diff, &diff->a, diff->markedA, childA, childLen,
+				'-');
+		}
+	}
+
+	/* children without a partner in the old tree were added */
+	for (int childB = nodeB->firstChild; childB >= 0;
+		childB = diff->b.nodes[childB].nextSibling) {
+		if (diff->paired[childB])
+			continue;
+		size_t childLen = appendHashedName(&diff->b, childB, diff->path, len,
+			sizeof diff->path);
+		reportSubtree(diff, &diff->b, diff->markedB, childB, childLen, '+');
+	}
+}
+
+/** Nodes of a hashed tree which match a filter */
+struct Marks {
+	/** hashed tree */
+	const struct HashedFdt * hashed;
+	/** one mark for each node */
+	bool * marked;
+};
+
+/** Action for the filter: mark a matching node
+ * \param fdt flattened device tree
+ * \param offset offset to the matching node
+ * \param data marks to be set
+ */
+static void markNode(const void * fdt, int offset, void * data)
+{
+	struct Marks * marks = data;
+	int index = findHashedNode(marks->hashed, offset);
+	if (index >= 0)
+		marks->marked[index] = true;
+}
+
+/** Mark all nodes of a hashed tree which match a node test.
+ * \param hashed hashed tree
+ * \param filter node test
+ * \return marks, one for each node
+ */
+static bool * markFdt(const struct HashedFdt * hashed,
+	const struct NodeTest * filter)
+{
+	struct Marks marks = {
+		.hashed = hashed,
+		.marked = calloc(hashed->count, sizeof *marks.marked),
+	};
+	assert(marks.marked);
+	queryFdtAction(hashed->fdt, filter, markNode, &marks);
+	return marks.marked;
+}
+
+/** Print the structural differences of two device trees.
+ *  Added nodes and properties are prefixed by '+', removed ones by '-' and
+ *  changed properties by '~'. Properties are printed as path[property].
+ * \param fdtA old flattened device tree
+ * \param fdtB new flattened device tree
+ * \param filter optional: only report differences of matching nodes
+ * \return number of differences, -1 if one of the trees is malformed
+ */
+int diffFdt(const void * fdtA, const void * fdtB,
+	const struct NodeTest * filter)
+{
+	struct Diff * diff = malloc(sizeof *diff);
+	assert(diff);
+
+	if (!hashFdt(fdtA, &diff->a)) {
+		free(diff);
+		error(0, 0, "FDT invalid: malformed structure block");
+		return -1;
+	}
+	if (!hashFdt(fdtB, &diff->b)) {
+		freeHashedFdt(&diff->a);
+		free(diff);
+		error(0, 0, "FDT invalid: malformed structure block");
+		return -1;
+	}
+
+	diff->paired = calloc(diff->b.count, sizeof *diff->paired);
+	assert(diff->paired);
+	diff->markedA = filter ? markFdt(&diff->a, filter) : NULL;
+	diff->markedB = filter ? markFdt(&diff->b, filter) : NULL;
+	diff->differences = 0;
+
+	/* start at the root nodes */
+	strcpy(diff->path, "/");
+	diffNodes(diff, 0, 0, 1);
+
+	int differences = diff->differences;
+	free(diff->markedA);
+	free(diff->markedB);
+	free(diff->paired);
+	freeHashedFdt(&diff->a);
+	freeHashedFdt(&diff->b);
+	free(diff);
+	return differences;
+}
@@ -0,0 +1,9 @@
+#ifndef _DIFF_H
+#define _DIFF_H
+
+#include <parser.h>
+
+int diffFdt(const void * fdtA, const void * fdtB,
+	const struct NodeTest * filter);
+
+#endif
@@ -19,23 +19,29 @@ extern int yylex();
   struct NodeTest * node;
   struct PropertyTest * properties;
   struct AtomicPropertyTest * atom;
+  struct Pattern * pattern;
+  struct Projection * projection;
 };
 
 /* non-terminal types */
 %type <node> node
 %type <properties> properties propertyExpr
 %type <atom> property
+%type <pattern> name
+%type <projection> projection propertyList
 
 /* terminals and their types */
 %token <number> NUMBER
-%token <text> IDENT STRING
-%token LE GE NE CONTAINS
+%token <text> IDENT GLOB STRING
+%token LE GE NE CONTAINS GLOBMATCH REGEXMATCH
 %token ERR
 
 /* destructors, in case of failure */
 %destructor { freeNodeTest($$); } <node>
 %destructor { freePropertyTest($$); } <properties>
 %destructor { freeAtomicPropertyTest($$); } <atom>
+%destructor { freePattern($$); } <pattern>
+%destructor { freeProjection($$); } <projection>
 
 /* operator precedences and associativity */
 %left '|'
@@ -44,18 +50,36 @@ extern int yylex();
 
 %%
 
-/* start-symbol is a node test */
+/* start-symbol is a node test, optionally followed by a projection */
 start:
   node
-    { *parsedNodeTest = newNodeTest(NODE_TEST_TYPE_ROOT, NULL, NULL, $1); };
+    { *parsedNodeTest = newNodeTest(NODE_TEST_TYPE_ROOT, NULL, NULL, $1); }
+ |node projection
+    { *parsedNodeTest = newNodeTest(NODE_TEST_TYPE_ROOT, NULL, NULL, $1);
+      (*parsedNodeTest)->projection = $2; }
+ ;
+
+/* a projection is a list of properties enclosed by braces */
+projection: '{' propertyList '}' { $$ = $2; };
+
+/* a list of properties is separated by commas. Property names containing
+ * commas have to be quoted.
+ */
+propertyList:
+  IDENT                  { $$ = newProjection($1, NULL); }
+ |STRING                 { $$ = newProjection($1, NULL); }
+ |IDENT ',' propertyList { $$ = newProjection($1, $3); }
+ |STRING ',' propertyList { $$ = newProjection($1, $3); }
+ ;
 
 /* a node is ... */
 node:
   '/' node                  /* an empty test -> descend */
-    { $$ = newNodeTest(NODE_TEST_TYPE_DESCEND, NULL, NULL, $2); } 
- |'/' IDENT properties node /* a node test with a name and properties */ 
+    { /* a trailing '/' means the node itself: there is nothing to descend to */
+      $$ = $2 ? newNodeTest(NODE_TEST_TYPE_DESCEND, NULL, NULL, $2) : NULL; }
+ |'/' name properties node  /* a node test with a name and properties */ 
     { $$ = newNodeTest(NODE_TEST_TYPE_NODE, $2, $3, $4); }
- |'/' IDENT node            /* a node test with a name without properties */
+ |'/' name node             /* a node test with a name without properties */
     { $$ = newNodeTest(NODE_TEST_TYPE_NODE, $2, NULL, $3); }
  |'/' properties node       /* a node test without a name but with properties */
     { $$ = newNodeTest(NODE_TEST_TYPE_NODE, NULL, $2, $3); }
@@ -63,8 +87,29 @@ node:
     { $$ = NULL; }
  ;
 
-/* properties are enclosed by brackets */ 
-properties: '[' propertyExpr ']' { $$ = $2; };
+/* a node name is ... (a trailing '@' ignores the unit address) */
+name:
+  IDENT       /* an exact name */
+    { $$ = newPattern(PATTERN_TYPE_EXACT, $1, NULL); }
+ |GLOB        /* a glob pattern */
+    { const char * err;
+      if (!($$ = newPattern(PATTERN_TYPE_GLOB, $1, &err))) {
+        yyerror(parsedNodeTest, unparsedExpression, err);
+        YYERROR;
+      } }
+ |'~' STRING  /* a regular expression */
+    { const char * err;
+      if (!($$ = newPattern(PATTERN_TYPE_REGEX, $2, &err))) {
+        yyerror(parsedNodeTest, unparsedExpression, err);
+        YYERROR;
+      } }
+ ;
+
+/* properties are enclosed by brackets, empty brackets test nothing */ 
+properties:
+  '[' propertyExpr ']' { $$ = $2; }
+ |'[' ']'              { $$ = NULL; }
+ ;
 
 /* a compound property is ... */
 propertyExpr:
@@ -77,7 +122,6 @@ propertyExpr:
     { $$ = newPropertyTestUnary(PROPERTY_TEST_OP_NEG, $2); }
  |property /* an atomic property */
     { $$ = newPropertyTestAtomic($1); }
- | /* empty */ { $$ = NULL; }
  ;
 
 /* an atomic property is ... */
@@ -105,4 +149,18 @@ property:
  |IDENT CONTAINS STRING /* a "contains"-test on a string array */
     { $$ = newAtomicPropertyTestString(ATOMIC_PROPERTY_TEST_OP_CONTAINS, $1,
       $3); }
+ |IDENT GLOBMATCH STRING /* a glob-test on a string array */
+    { const char * err;
+      if (!($$ = newAtomicPropertyTestPattern(ATOMIC_PROPERTY_TEST_OP_GLOB,
+        $1, $3, &err))) {
+        yyerror(parsedNodeTest, unparsedExpression, err);
+        YYERROR;
+      } }
+ |IDENT REGEXMATCH STRING /* a regex-test on a string array */
+    { const char * err;
+      if (!($$ = newAtomicPropertyTestPattern(ATOMIC_PROPERTY_TEST_OP_REGEX,
+        $1, $3, &err))) {
+        yyerror(parsedNodeTest, unparsedExpression, err);
+        YYERROR;
+      } }
  ;
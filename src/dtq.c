@@ -3,27 +3,211 @@
 #include <config.h>
 #endif
 
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
-#include <sys/mman.h>
 #include <stdio.h>
+#include <stdbool.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
 #include <errno.h>
 #include <error.h>
+#include <assert.h>
 #include <libfdt.h>
 
 #include <parser.h>
 #include <query.h>
+#include <blob.h>
+#include <diff.h>
+#include <watch.h>
+#include <embed.h>
+#include <serve.h>
+
+/** Exit code of --diff for errors, as 1 means the trees differ */
+#define DIFF_TROUBLE 2
+
+/** Print the usage and exit
+ * \param name program name
+ * \param status exit code
+ */
+static void usage(const char * name, int status)
+{
+	error(status, 0, "Usage: %s [--embedded] <filename> <query>\n"
+		"       %s --diff <old> <new> [<query>]\n"
+		"       %s --watch <filename> <query>...\n"
+		"       %s --serve <socket> <filename>...\n"
+		"       %s --client <socket> <filename> <query>\n"
+		"A <filename> of '-' reads from stdin (except for --watch).\n"
+		"Mapping options: --prefetch, --readahead, --hugepages, --drop-cache",
+		name, name, name, name, name);
+}
+
+/** Compare two device trees
+ * \param old file name of the old tree
+ * \param new file name of the new tree
+ * \param expr optional expression to limit the diff to matching nodes
+ * \return exit code like diff(1): 0 if the trees are equal, 1 if they
+ *         differ, DIFF_TROUBLE (2) if a query or blob is invalid
+ */
+static int doDiff(const char * old, const char * new, const char * expr)
+{
+	struct NodeTest * filter = NULL;
+	if (expr) {
+		filter = parseNodeTestExpr(expr);
+		if (!filter)
+			return DIFF_TROUBLE;
+	}
+
+	struct Blob a, b;
+	if (!openBlob(old, &a))
+		exit(DIFF_TROUBLE);
+	if (!openBlob(new, &b))
+		exit(DIFF_TROUBLE);
+
+	int differences = diffFdt(a.fdt, b.fdt, filter);
+
+	/* cleanup */
+	freeNodeTest(filter);
+	closeBlob(&a);
+	closeBlob(&b);
+
+	if (differences < 0)
+		return DIFF_TROUBLE;
+	return differences ? 1 : EXIT_SUCCESS;
+}
+
+/** Query all device trees embedded in a file, e.g. in a FIT image or
+ *  appended to a kernel image. The results are labeled by the FIT subimage
+ *  name and/or the offset of the device tree in the file.
+ * \param filename file containing the device trees
+ * \param query node test, ownership is transferred
+ * \return exit code
+ */
+static int queryEmbedded(const char * filename, struct NodeTest * query)
+{
+	struct Blob blob;
+	if (!mapFile(filename, &blob))
+		exit(EXIT_FAILURE);
+
+	struct EmbeddedFdt * fdts;
+	int count = findEmbeddedFdts(blob.fdt, blob.used, &fdts);
+	if (!count)
+		error(EXIT_FAILURE, 0, "No device tree found in '%s'", filename);
+
+	for (int i = 0; i < count; i++) {
+		/* image names can be of any length: no fixed-size buffer */
+		char * label;
+		int len;
+		if (fdts[i].image && !fdts[i].offset)
+			len = asprintf(&label, "%s", fdts[i].image);
+		else if (fdts[i].image)
+			len = asprintf(&label, "@0x%zx/%s", fdts[i].offset,
+				fdts[i].image);
+		else
+			len = asprintf(&label, "@0x%zx", fdts[i].offset);
+		assert(len >= 0);
+		queryFdt(fdts[i].fdt, query, label, stdout);
+		free(label);
+	}
+
+	/* cleanup */
+	freeEmbeddedFdts(fdts, count);
+	freeNodeTest(query);
+	closeBlob(&blob);
+
+	return EXIT_SUCCESS;
+}
 
 int main(int argc, char * argv[])
 {
-	if (argc != 3)
-		error(EXIT_FAILURE, 0, "Usage: %s <filename> <query>", argv[0]);
+	static const struct option options[] = {
+		{ "diff", no_argument, NULL, 'd' },
+		{ "watch", no_argument, NULL, 'w' },
+		{ "embedded", no_argument, NULL, 'e' },
+		{ "serve", required_argument, NULL, 's' },
+		{ "client", required_argument, NULL, 'c' },
+		{ "prefetch", no_argument, NULL, 'p' },
+		{ "readahead", no_argument, NULL, 'r' },
+		{ "hugepages", no_argument, NULL, 'H' },
+		{ "drop-cache", no_argument, NULL, 'D' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	const char * name = argv[0];
+	bool diff = false;
+	bool watch = false;
+	bool embedded = false;
+	const char * serve = NULL;
+	const char * client = NULL;
+	unsigned policy = 0;
+	int opt;
+	while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+		switch (opt) {
+		case 'd':
+			diff = true;
+			break;
+		case 'w':
+			watch = true;
+			break;
+		case 'e':
+			embedded = true;
+			break;
+		case 's':
+			serve = optarg;
+			break;
+		case 'c':
+			client = optarg;
+			break;
+		case 'p':
+			policy |= MAP_POLICY_PREFETCH;
+			break;
+		case 'r':
+			policy |= MAP_POLICY_READAHEAD;
+			break;
+		case 'H':
+			policy |= MAP_POLICY_HUGEPAGES;
+			break;
+		case 'D':
+			policy |= MAP_POLICY_DROP;
+			break;
+		default:
+			usage(name, EXIT_FAILURE);
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	setMapPolicy(policy);
+
+	if (diff) {
+		if (argc != 2 && argc != 3)
+			usage(name, DIFF_TROUBLE);
+		return doDiff(argv[0], argv[1], argc == 3 ? argv[2] : NULL);
+	}
+
+	if (serve) {
+		if (argc < 1)
+			usage(name, EXIT_FAILURE);
+		return serveFdts(serve, argv, argc);
+	}
+
+	if (client) {
+		if (argc != 2)
+			usage(name, EXIT_FAILURE);
+		return queryServer(client, argv[0], argv[1]);
+	}
+
+	if (watch) {
+		if (argc < 2)
+			usage(name, EXIT_FAILURE);
+		if (!strcmp(argv[0], "-"))
+			error(EXIT_FAILURE, 0, "Cannot watch stdin");
+		return watchFdt(argv[0], argv + 1, argc - 1);
+	}
+
+	if (argc != 2)
+		usage(name, EXIT_FAILURE);
 
 	/* parse expression */
-	struct NodeTest * query = parseNodeTestExpr(argv[2]);
+	struct NodeTest * query = parseNodeTestExpr(argv[1]);
 
 	if (!query)
 		return EXIT_FAILURE;
@@ -32,36 +216,21 @@ int main(int argc, char * argv[])
 	printNodeTest(query);
 	puts("");
 
-	/* open device tree */
-	const char * filename = argv[1];
-	int fd = open(filename, O_RDONLY | O_CLOEXEC);
-	if (fd < 0)
-		error(EXIT_FAILURE, errno, "Could not open '%s'", filename);
-
-	struct stat st;
-	if (fstat(fd, &st) < 0) {
-		close(fd);
-		error(EXIT_FAILURE, errno, "Could not stat '%s'", filename);
-	}
-
-	/* map it into memory */
-	void * fdt = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-	close(fd);
-	if (fdt == MAP_FAILED)
-		error(EXIT_FAILURE, errno, "Could not mmap '%s'", filename);
-	if (st.st_size < sizeof(struct fdt_header))
-		error(EXIT_FAILURE, 0, "FDT invalid: cannot read header");
+	if (embedded)
+		return queryEmbedded(argv[0], query);
 
-	if (fdt_totalsize(fdt) != st.st_size)
-		error(EXIT_FAILURE, 0, "FDT invalid: size mismatch");
+	/* open device tree */
+	struct Blob blob;
+	if (!openBlob(argv[0], &blob))
+		return EXIT_FAILURE;
 
 	/* do the query */
-	queryFdt(fdt, query);
+	queryFdt(blob.fdt, query, NULL, stdout);
 
 	/* cleanup */
 	freeNodeTest(query);
 
-	munmap(fdt, st.st_size);
+	closeBlob(&blob);
 
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,268 @@
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <embed.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <error.h>
+#include <libfdt.h>
+
+/** Found device trees */
+struct Found {
+	/** device trees */
+	struct EmbeddedFdt * fdts;
+	/** number of device trees */
+	int count;
+	/** number of allocated device trees */
+	int capacity;
+};
+
+/** Check whether libfdt can use a device tree in place. It requires device
+ *  trees to be 8-byte aligned.
+ * \param data start of the device tree
+ * \return true if it is aligned
+ */
+static inline bool isAligned(const void * data)
+{
+	return !((uintptr_t)data & 7);
+}
+
+/** Copy a region of the file into an aligned buffer
+ * \param data start of the region
+ * \param size size of the region
+ * \return aligned copy, to be freed with free()
+ */
+static void * alignedCopy(const void * data, size_t size)
+{
+	void * copy;
+	int err = posix_memalign(&copy, 8, size ? size : 1);
+	assert(!err);
+	(void)err;
+	memcpy(copy, data, size);
+	return copy;
+}
+
+/** Add a found device tree. It is used in place if it is aligned, otherwise
+ *  it is copied.
+ * \param found found device trees
+ * \param fdt start of the device tree
+ * \param size size of the device tree
+ * \param offset offset of the device tree or the containing FIT image
+ * \param image optional: name of the FIT subimage
+ */
+static void addFound(struct Found * found, const void * fdt, size_t size,
+	size_t offset, const char * image)
+{
+	if (found->count == found->capacity) {
+		found->capacity = found->capacity ? found->capacity * 2 : 4;
+		found->fdts = realloc(found->fdts,
+			found->capacity * sizeof *found->fdts);
+		assert(found->fdts);
+	}
+	void * copy = isAligned(fdt) ? NULL : alignedCopy(fdt, size);
+	char * name = NULL;
+	if (image) {
+		name = strdup(image);
+		assert(name);
+	}
+	found->fdts[found->count++] = (struct EmbeddedFdt) {
+		.fdt = copy ? copy : fdt,
+		.offset = offset,
+		.image = name,
+		.copy = copy,
+	};
+}
+
+/** Validate the header of a device tree candidate.
+ *  The header is checked in an aligned copy, so the candidate may be at any
+ *  address.
+ * \param data start of the candidate
+ * \param avail number of bytes available at the candidate
+ * \param err set to the libfdt error if the candidate is invalid
+ * \return total size of the device tree, 0 if it is invalid
+ */
+static size_t validFdt(const void * data, size_t avail, int * err)
+{
+	struct fdt_header header;
+	if (avail < sizeof header) {
+		*err = -FDT_ERR_TRUNCATED;
+		return 0;
+	}
+	memcpy(&header, data, sizeof header);
+	if (fdt_magic(&header) != FDT_MAGIC) {
+		*err = -FDT_ERR_BADMAGIC;
+		return 0;
+	}
+
+	size_t size = fdt_totalsize(&header);
+	if (size < sizeof header || size > avail) {
+		*err = -FDT_ERR_TRUNCATED;
+		return 0;
+	}
+	/* the structure block must be within the blob */
+	if (fdt_off_dt_struct(&header) >= size ||
+		fdt_off_dt_strings(&header) > size ||
+		(fdt_version(&header) >= 17 &&
+		fdt_size_dt_struct(&header) > size - fdt_off_dt_struct(&header))) {
+		*err = -FDT_ERR_TRUNCATED;
+		return 0;
+	}
+	if ((*err = fdt_check_header(&header)))
+		return 0;
+	return size;
+}
+
+/** Add the device trees which are subimages of a FIT image.
+ *  The subimage data is either embedded in the FIT (data) or placed after it
+ *  (data-offset relative to the end of the FIT, or data-position relative to
+ *  the start of the FIT).
+ * \param found found device trees
+ * \param fit FIT image, a valid device tree, not necessarily aligned
+ * \param fitSize total size of the FIT image's device tree
+ * \param avail number of bytes available at the FIT image
+ * \param offset offset of the FIT image in the file
+ * \return size of the FIT image including its external data, 0 if the blob
+ *  is no FIT image. A FIT image without usable device trees adds nothing.
+ */
+static size_t addFitImages(struct Found * found, const void * fit,
+	size_t fitSize, size_t avail, size_t offset)
+{
+	/* libfdt needs the FIT image itself aligned to read its metadata */
+	void * copy = isAligned(fit) ? NULL : alignedCopy(fit, fitSize);
+	const void * meta = copy ? copy : fit;
+
+	int images = fdt_path_offset(meta, "/images");
+	if (images < 0) {
+		free(copy);
+		return 0;
+	}
+
+	/* external data starts at the first 4-byte boundary after the FIT */
+	size_t external = (fitSize + 3) & ~(size_t)3;
+	size_t size = fitSize;
+
+	for (int image = fdt_first_subnode(meta, images); image >= 0;
+		image = fdt_next_subnode(meta, image)) {
+		const char * name = fdt_get_name(meta, image, NULL);
+		const char * data;
+		size_t len;
+		int plen;
+		const fdt32_t * prop;
+
+		if ((data = fdt_getprop(meta, image, "data", &plen))) {
+			/* the data in the file, rather than in the copy */
+			data = (const char *)fit + (data - (const char *)meta);
+			len = plen;
+		} else if ((prop = fdt_getprop(meta, image, "data-size", &plen)) &&
+			plen == 4) {
+			size_t pos;
+			len = fdt32_to_cpu(*prop);
+			if ((prop = fdt_getprop(meta, image, "data-position", &plen)) &&
+				plen == 4)
+				pos = fdt32_to_cpu(*prop);
+			else if ((prop = fdt_getprop(meta, image, "data-offset", &plen)) &&
+				plen == 4)
+				pos = external + fdt32_to_cpu(*prop);
+			else
+				continue;
+			if (pos > avail || len > avail - pos)
+				continue;
+			data = (const char *)fit + pos;
+			if (pos + len > size)
+				size = pos + len;
+		} else {
+			continue;
+		}
+
+		int err;
+		size_t fdtSize = validFdt(data, len, &err);
+		if (fdtSize) {
+			addFound(found, data, fdtSize, offset, name);
+		} else {
+			const char * type = fdt_getprop(meta, image, "type", NULL);
+			const char * compression =
+				fdt_getprop(meta, image, "compression", NULL);
+			if (!type || strcmp(type, "flat_dt"))
+				continue;
+			if (compression && strcmp(compression, "none"))
+				error(0, 0, "Skipping '%s': %s compressed", name, compression);
+			else
+				error(0, 0, "Skipping '%s': %s", name, fdt_strerror(err));
+		}
+	}
+
+	free(copy);
+	return size;
+}
+
+/** Find the device trees embedded in a file. They are used in place, unless
+ *  they are not 8-byte aligned as libfdt requires: those are copied.
+ *  If the file starts with a FIT image, its device tree subimages are used.
+ *  If the file starts with any other device tree, it is used as is.
+ *  Otherwise, the file is scanned for device trees with a valid header, e.g.
+ *  a device tree appended to a kernel image. FIT images found by the scan are
+ *  expanded as well.
+ * \param data contents of the file
+ * \param size size of the file
+ * \param fdts found device trees, to be freed with freeEmbeddedFdts()
+ * \return number of found device trees
+ */
+int findEmbeddedFdts(const void * data, size_t size,
+	struct EmbeddedFdt ** fdts)
+{
+	struct Found found = { 0 };
+	const char * start = data;
+	const char * end = start + size;
+	const char magic[4] = { 0xd0, 0x0d, 0xfe, 0xed };
+
+	for (const char * ptr = start; ptr < end; ) {
+		int err;
+		size_t fdtSize = validFdt(ptr, end - ptr, &err);
+		if (fdtSize) {
+			size_t fitSize = addFitImages(&found, ptr, fdtSize, end - ptr,
+				ptr - start);
+			if (fitSize)
+				fdtSize = fitSize;
+			else
+				addFound(&found, ptr, fdtSize, ptr - start, NULL);
+			/* a FIT image at the start may be followed by its external
+			 * data: there is nothing else to find
+			 */
+			if (ptr == start)
+				break;
+			ptr += fdtSize;
+		} else {
+			/* a magic with an implausible size is most likely a coincidence
+			 * in other data, anything else is worth a note
+			 */
+			if (err != -FDT_ERR_BADMAGIC && err != -FDT_ERR_TRUNCATED)
+				error(0, 0, "Skipping device tree at 0x%zx: %s",
+					(size_t)(ptr - start), fdt_strerror(err));
+			ptr = memmem(ptr + 1, end - ptr - 1, magic, sizeof magic);
+			if (!ptr)
+				break;
+		}
+	}
+
+	*fdts = found.fdts;
+	return found.count;
+}
+
+/** Free found device trees
+ * \param fdts found device trees
+ * \param count number of found device trees
+ */
+void freeEmbeddedFdts(struct EmbeddedFdt * fdts, int count)
+{
+	for (int i = 0; i < count; i++) {
+		free(fdts[i].copy);
+		free(fdts[i].image);
+	}
+	free(fdts);
+}
@@ -0,0 +1,25 @@
+#ifndef _EMBED_H
+#define _EMBED_H
+
+#include <stddef.h>
+
+/** A device tree blob embedded in a larger file */
+struct EmbeddedFdt {
+	/** start of the device tree, points into the file if it is aligned
+	 *  there, to the copy otherwise
+	 */
+	const void * fdt;
+	/** offset of the device tree or the containing FIT image in the file */
+	size_t offset;
+	/** optional: name of the FIT subimage */
+	char * image;
+	/** aligned copy of the device tree, NULL if it is used in place */
+	void * copy;
+};
+
+int findEmbeddedFdts(const void * data, size_t size,
+	struct EmbeddedFdt ** fdts);
+
+void freeEmbeddedFdts(struct EmbeddedFdt * fdts, int count);
+
+#endif
@@ -0,0 +1,268 @@
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <hash.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <assert.h>
+#include <libfdt.h>
+
+/** Hash some bytes (FNV-1a)
+ * \param hash hash to continue with
+ * \param data bytes to be hashed
+ * \param len number of bytes
+ * \return new hash
+ */
+uint64_t hashBytes(uint64_t hash, const void * data, size_t len)
+{
+	const unsigned char * bytes = data;
+	for (size_t i = 0; i < len; i++) {
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ull;
+	}
+	return hash;
+}
+
+/** Mix a hash, so that sums of hashes stay well distributed (splitmix64)
+ * \param hash hash to be mixed
+ * \return mixed hash
+ */
+static uint64_t mixHash(uint64_t hash)
+{
+	hash ^= hash >> 30;
+	hash *= 0xbf58476d1ce4e5b9ull;
+	hash ^= hash >> 27;
+	hash *= 0x94d049bb133111ebull;
+	hash ^= hash >> 31;
+	return hash;
+}
+
+/** State of a node which is still open while walking the structure block */
+struct OpenNode {
+	/** index of the node */
+	int index;
+	/** index of the last child seen so far */
+	int lastChild;
+	/** hash of the node name */
+	uint64_t name;
+	/** sum of the property hashes (independent of their order) */
+	uint64_t properties;
+	/** sum of the child hashes (independent of their order) */
+	uint64_t children;
+};
+
+/** Hash all subtrees of a device tree in one linear pass.
+ *  The hash of a node covers its name, its properties (independent of their
+ *  order) and the hashes of its children (independent of their order as
+ *  well).
+ * \param fdt flattened device tree
+ * \param hashed index to be filled
+ * \return true on success, false if the structure block is malformed
+ */
+bool hashFdt(const void * fdt, struct HashedFdt * hashed)
+{
+	int capacity = 64;
+	int stackSize = 16;
+	int depth = -1;
+	struct OpenNode * stack = malloc(stackSize * sizeof *stack);
+	assert(stack);
+
+	hashed->fdt = fdt;
+	hashed->count = 0;
+	hashed->nodes = malloc(capacity * sizeof *hashed->nodes);
+	assert(hashed->nodes);
+
+	int offset = 0;
+	int nextOffset;
+	while (true) {
+		uint32_t tag = fdt_next_tag(fdt, offset, &nextOffset);
+		switch (tag) {
+		case FDT_BEGIN_NODE: {
+			if (hashed->count == capacity) {
+				capacity *= 2;
+				hashed->nodes = realloc(hashed->nodes,
+					capacity * sizeof *hashed->nodes);
+				assert(hashed->nodes);
+			}
+			if (++depth == stackSize) {
+				stackSize *= 2;
+				stack = realloc(stack, stackSize * sizeof *stack);
+				assert(stack);
+			}
+
+			int index = hashed->count++;
+			struct HashedNode * node = &hashed->nodes[index];
+			node->offset = offset;
+			node->parent = depth ? stack[depth - 1].index : -1;
+			node->firstChild = -1;
+			node->nextSibling = -1;
+			node->properties = 0;
+			node->hash = 0;
+
+			/* link the node to its parent */
+			if (depth) {
+				struct OpenNode * parent = &stack[depth - 1];
+				if (parent->lastChild < 0)
+					hashed->nodes[parent->index].firstChild = index;
+				else
+					hashed->nodes[parent->lastChild].nextSibling = index;
+				parent->lastChild = index;
+			}
+
+			int len;
+			const char * name = fdt_get_name(fdt, offset, &len);
+			if (!name)
+				goto fail;
+			stack[depth] = (struct OpenNode) {
+				.index = index,
+				.lastChild = -1,
+				.name = hashBytes(HASH_SEED, name, len),
+			};
+		}
+			break;
+		case FDT_PROP: {
+			if (depth < 0)
+				goto fail;
+			int len;
+			const struct fdt_property * prop =
+				fdt_get_property_by_offset(fdt, offset, &len);
+			if (!prop)
+				goto fail;
+			const char * name = fdt_string(fdt, fdt32_to_cpu(prop->nameoff));
+			/* include the terminator to separate name and value */
+			uint64_t hash = hashBytes(HASH_SEED, name, strlen(name) + 1);
+			hash = hashBytes(hash, prop->data, len);
+			stack[depth].properties += mixHash(hash);
+		}
+			break;
+		case FDT_END_NODE: {
+			if (depth < 0)
+				goto fail;
+			struct OpenNode * node = &stack[depth];
+			uint64_t hash = mixHash(node->name + node->properties);
+			hash = mixHash(hash ^ (node->children * 0x9e3779b97f4a7c15ull));
+			hashed->nodes[node->index].properties = node->properties;
+			hashed->nodes[node->index].hash = hash;
+			if (--depth >= 0)
+				stack[depth].children += mixHash(hash);
+		}
+			break;
+		case FDT_NOP:
+			break;
+		case FDT_END:
+			/* also returned if the structure block is truncated */
+			if (nextOffset < 0 || depth != -1 || !hashed->count)
+				goto fail;
+			free(stack);
+			return true;
+		default:
+			goto fail;
+		}
+		offset = nextOffset;
+	}
+
+fail:
+	free(stack);
+	freeHashedFdt(hashed);
+	return false;
+}
+
+/** Free the nodes of a hashed device tree.
+ * \param hashed index to be freed
+ */
+void freeHashedFdt(struct HashedFdt * hashed)
+{
+	free(hashed->nodes);
+	hashed->nodes = NULL;
+	hashed->count = 0;
+}
+
+/** Find a node of a hashed device tree by its offset.
+ * \param hashed index to search in
+ * \param offset offset of the node
+ * \return index of the node or -1 if there is none at the given offset
+ */
+int findHashedNode(const struct HashedFdt * hashed, int offset)
+{
+	int low = 0;
+	int high = hashed->count - 1;
+
+	/* the offsets are ascending: binary search */
+	while (low <= high) {
+		int mid = low + (high - low) / 2;
+		int midOffset = hashed->nodes[mid].offset;
+		if (midOffset == offset)
+			return mid;
+		else if (midOffset < offset)
+			low = mid + 1;
+		else
+			high = mid - 1;
+	}
+	return -1;
+}
+
+/** Test whether two nodes of hashed trees have the same name.
+ * \param a first hashed tree
+ * \param indexA index of the node in the first tree
+ * \param b second hashed tree
+ * \param indexB index of the node in the second tree
+ * \return true if the names are equal
+ */
+static bool sameName(const struct HashedFdt * a, int indexA,
+	const struct HashedFdt * b, int indexB)
+{
+	int lenA, lenB;
+	const char * nameA = fdt_get_name(a->fdt, a->nodes[indexA].offset, &lenA);
+	const char * nameB = fdt_get_name(b->fdt, b->nodes[indexB].offset, &lenB);
+	return lenA == lenB && !memcmp(nameA, nameB, lenA);
+}
+
+/** Find the partner of a node among the children of a node of another tree.
+ *  Usually, the order of the children is the same in both trees, so the
+ *  child at the same position is tried first.
+ * \param a tree of the node
+ * \param childA index of the node
+ * \param b other tree
+ * \param parentB index of the parent node in the other tree
+ * \param slot index of the child at the same position, -1 if there is none
+ * \param paired nodes of the other tree which already have a partner
+ * \return index of the partner or -1 if there is none
+ */
+int pairHashedChild(const struct HashedFdt * a, int childA,
+	const struct HashedFdt * b, int parentB, int slot, const bool * paired)
+{
+	if (slot >= 0 && !paired[slot] && sameName(a, childA, b, slot))
+		return slot;
+
+	for (int childB = b->nodes[parentB].firstChild; childB >= 0;
+		childB = b->nodes[childB].nextSibling) {
+		if (!paired[childB] && sameName(a, childA, b, childB))
+			return childB;
+	}
+	return -1;
+}
+
+/** Append the name of a node to the path of its parent.
+ * \param hashed hashed tree
+ * \param index index of the node
+ * \param path path of the parent node
+ * \param len length of the path of the parent node
+ * \param size size of the path buffer
+ * \return length of the path of the node
+ */
+size_t appendHashedName(const struct HashedFdt * hashed, int index,
+	char * path, size_t len, size_t size)
+{
+	int nameLen;
+	const char * name = fdt_get_name(hashed->fdt, hashed->nodes[index].offset,
+		&nameLen);
+	int res = snprintf(path + len, size - len, "%s%.*s", len > 1 ? "/" : "",
+		nameLen, name);
+	if (res < 0 || len + res >= size)
+		return size - 1;
+	return len + res;
+}
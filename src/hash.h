@@ -0,0 +1,54 @@
+#ifndef _HASH_H
+#define _HASH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/** A node of a hashed device tree */
+struct HashedNode {
+	/** offset of the node in the blob */
+	int offset;
+	/** index of the parent node, -1 for the root node */
+	int parent;
+	/** index of the first child node, -1 if there is none */
+	int firstChild;
+	/** index of the next sibling node, -1 if there is none */
+	int nextSibling;
+	/** hash of the node's own properties */
+	uint64_t properties;
+	/** hash of the node name, its properties and all of its children */
+	uint64_t hash;
+};
+
+/** Index of subtree hashes of a device tree.
+ *  The nodes are stored in the order in which they appear in the blob,
+ *  i.e. index 0 is the root node and the offsets are ascending.
+ */
+struct HashedFdt {
+	/** flattened device tree */
+	const void * fdt;
+	/** hashed nodes */
+	struct HashedNode * nodes;
+	/** number of nodes */
+	int count;
+};
+
+/** Initial value for hashBytes() */
+#define HASH_SEED 0xcbf29ce484222325ull
+
+uint64_t hashBytes(uint64_t hash, const void * data, size_t len);
+
+bool hashFdt(const void * fdt, struct HashedFdt * hashed);
+
+void freeHashedFdt(struct HashedFdt * hashed);
+
+int findHashedNode(const struct HashedFdt * hashed, int offset);
+
+int pairHashedChild(const struct HashedFdt * a, int childA,
+	const struct HashedFdt * b, int parentB, int slot, const bool * paired);
+
+size_t appendHashedName(const struct HashedFdt * hashed, int index,
+	char * path, size_t len, size_t size);
+
+#endif
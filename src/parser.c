@@ -4,6 +4,7 @@
 #endif
 
 #include "parser.h"
+#include "pattern.h"
 
 #include <dtq-bison.h>
 #include <stdlib.h>
@@ -19,6 +20,9 @@ extern int yyparse();
 extern YY_BUFFER_STATE yy_scan_string(const char * str);
 extern void yy_delete_buffer(YY_BUFFER_STATE buffer);
 
+/** Stream for syntax errors of the expression being parsed */
+static FILE * parseErrors;
+
 /** Parse a node test from a string
  * \param expr node test expression
  * \return AST of the expression on success, NULL otherwise.
@@ -26,10 +30,22 @@ extern void yy_delete_buffer(YY_BUFFER_STATE buffer);
  *  stderr.
  */
 struct NodeTest * parseNodeTestExpr(const char * expr)
+{
+	return parseNodeTestExprErrors(expr, stderr);
+}
+
+/** Parse a node test from a string, reporting errors to a given stream
+ * \param expr node test expression
+ * \param errors stream for error messages (e.g. syntax errors)
+ * \return AST of the expression on success, NULL otherwise.
+ */
+struct NodeTest * parseNodeTestExprErrors(const char * expr, FILE * errors)
 {
 	struct NodeTest * parsedExpression;
+	parseErrors = errors;
 
 	/* tell the lexer to scan the given expression string */
+	resetLexer();
 	YY_BUFFER_STATE buffer = yy_scan_string(expr);
 	/* let the parser do its magic */
 	int ret = yyparse(&parsedExpression, expr);
@@ -50,7 +66,7 @@ struct NodeTest * parseNodeTestExpr(const char * expr)
  */
 void lexError(const char * yytext)
 {
-	fprintf(stderr, "Unknown character '%c'\n", *yytext);
+	fprintf(parseErrors, "Unknown character '%c'\n", *yytext);
 }
 
 /** Callback for parser error
@@ -99,32 +115,86 @@ void yyerror(struct NodeTest ** parsedExpression, const char * expr,
 	}
 
 	/* print generated message of the parser */
-	offset += fprintf(stderr, "%s at ", err);
+	offset += fprintf(parseErrors, "%s at ", err);
 	if (truncate_l) {
 		/* if truncated on the left : print indicator */
 		offset += 1;
-		fprintf(stderr, "…");
+		fprintf(parseErrors, "…");
 	}
 	/* print the expression (i.e. it's erroneous substring) */
-	fprintf(stderr, "%.*s", (int)printLen, expr);
+	fprintf(parseErrors, "%.*s", (int)printLen, expr);
 	if (truncate_r) /* if truncated on the right: print indicator */
-		fprintf(stderr, "…");
-	fprintf(stderr, "\n");
+		fprintf(parseErrors, "…");
+	fprintf(parseErrors, "\n");
 
 	/* print spaces until we reach the erroneous substring */
 	const char spc[10] = { [0 ... 9] = ' ' };
 	for (; offset >= 10; offset -= 10)
-		fwrite(spc, sizeof *spc, sizeof spc, stderr);
+		fwrite(spc, sizeof *spc, sizeof spc, parseErrors);
 	if (offset)
-		fwrite(spc, sizeof *spc, offset, stderr);
+		fwrite(spc, sizeof *spc, offset, parseErrors);
 
 	/* print circumflexes below the erroneous substring */
 	const char mark[10] = { [0 ... 9] = '^' };
 	for (; errlen >= 10; errlen -= 10)
-		fwrite(mark, sizeof *mark, sizeof mark, stderr);
+		fwrite(mark, sizeof *mark, sizeof mark, parseErrors);
 	if (errlen)
-		fwrite(mark, sizeof *mark, errlen, stderr);
-	fputc('\n', stderr);
+		fwrite(mark, sizeof *mark, errlen, parseErrors);
+	fputc('\n', parseErrors);
+}
+
+/** Instantiate a new name pattern.
+ *  Globs and regular expressions are compiled right away. A name (or glob)
+ *  ending with '@' only matches the part of a name before the "@unit-address".
+ * \param type pattern type
+ * \param text name or pattern, ownership is transferred
+ * \param err error message in case of failure
+ * \return name pattern or NULL if the pattern is invalid
+ */
+struct Pattern * newPattern(enum PATTERN_TYPE type, char * text,
+	const char ** err)
+{
+	struct Pattern * pattern = malloc(sizeof *pattern);
+	assert(pattern);
+	pattern->type = type;
+	pattern->text = text;
+	pattern->dfa = NULL;
+
+	size_t len = strlen(text);
+	pattern->baseName = type != PATTERN_TYPE_REGEX && len > 1 &&
+		text[len - 1] == '@';
+	if (pattern->baseName)
+		text[len - 1] = '\0';
+
+	if (type == PATTERN_TYPE_GLOB)
+		pattern->dfa = compileGlob(text, err);
+	else if (type == PATTERN_TYPE_REGEX)
+		pattern->dfa = compileRegex(text, err);
+
+	if (type != PATTERN_TYPE_EXACT && !pattern->dfa) {
+		freePattern(pattern);
+		return NULL;
+	}
+	return pattern;
+}
+
+/** Match a node name against a name pattern, without allocations
+ * \param pattern name pattern
+ * \param name node name, not necessarily terminated
+ * \param len length of the node name
+ * \return true if the name matches
+ */
+bool matchPattern(const struct Pattern * pattern, const char * name, int len)
+{
+	if (pattern->baseName) {
+		const char * at = memchr(name, '@', len);
+		if (at)
+			len = at - name;
+	}
+
+	if (pattern->type == PATTERN_TYPE_EXACT)
+		return !strncmp(pattern->text, name, len) && !pattern->text[len];
+	return matchDfa(pattern->dfa, name, len);
 }
 
 /** Instantiate a new node test.
@@ -134,8 +204,9 @@ void yyerror(struct NodeTest ** parsedExpression, const char * expr,
  * \param subExpr optional sub expression, ownership is transferred
  * \param node test
  */
-struct NodeTest * newNodeTest(enum NODE_TEST_TYPE type, char * name,
-	struct PropertyTest * properties, struct NodeTest * subExpr)
+struct NodeTest * newNodeTest(enum NODE_TEST_TYPE type,
+	struct Pattern * name, struct PropertyTest * properties,
+	struct NodeTest * subExpr)
 {
 	struct NodeTest * test = malloc(sizeof *test);
 	assert(test);
@@ -143,9 +214,24 @@ struct NodeTest * newNodeTest(enum NODE_TEST_TYPE type, char * name,
 	test->name = name;
 	test->properties = properties;
 	test->subTest = subExpr;
+	test->projection = NULL;
 	return test;
 }
 
+/** Instantiate a new projection.
+ * \param property property name, ownership is transferred
+ * \param next optional further properties, ownership is transferred
+ * \return projection
+ */
+struct Projection * newProjection(char * property, struct Projection * next)
+{
+	struct Projection * projection = malloc(sizeof *projection);
+	assert(projection);
+	projection->property = property;
+	projection->next = next;
+	return projection;
+}
+
 /** Instantiate a new binary property test.
  * \param op operator
  * \param left left child
@@ -200,6 +286,7 @@ struct AtomicPropertyTest * newAtomicPropertyTestExist(char * property)
 	assert(test);
 	test->type = ATOMIC_PROPERTY_TEST_TYPE_EXIST;
 	test->property = property;
+	test->dfa = NULL;
 	return test;
 }
 
@@ -218,6 +305,7 @@ struct AtomicPropertyTest * newAtomicPropertyTestInteger(
 	test->op = op;
 	test->property = property;
 	test->integer = integer;
+	test->dfa = NULL;
 	return test;
 }
 
@@ -236,6 +324,33 @@ struct AtomicPropertyTest * newAtomicPropertyTestString(
 	test->op = op;
 	test->property = property;
 	test->string = string;
+	test->dfa = NULL;
+	return test;
+}
+
+/** Instantiate a new atomic property pattern atomic.
+ *  The pattern is compiled right away.
+ * \param op ATOMIC_PROPERTY_TEST_OP_GLOB or ATOMIC_PROPERTY_TEST_OP_REGEX
+ * \param property property name, ownership is transferred
+ * \param pattern pattern to test against, ownership is transferred
+ * \param err error message in case of failure
+ * \return property test or NULL if the pattern is invalid
+ */
+struct AtomicPropertyTest * newAtomicPropertyTestPattern(
+	enum ATOMIC_PROPERTY_TEST_OP op, char * property, char * pattern,
+	const char ** err)
+{
+	struct AtomicPropertyTest * test = newAtomicPropertyTestString(op,
+		property, pattern);
+	if (op == ATOMIC_PROPERTY_TEST_OP_GLOB)
+		test->dfa = compileGlob(pattern, err);
+	else
+		test->dfa = compileRegex(pattern, err);
+
+	if (!test->dfa) {
+		freeAtomicPropertyTest(test);
+		return NULL;
+	}
 	return test;
 }
 
@@ -250,6 +365,7 @@ void freeAtomicPropertyTest(struct AtomicPropertyTest * test)
 	/* free also data if necessary */
 	if (test->type == ATOMIC_PROPERTY_TEST_TYPE_STR)
 		free(test->string);
+	freeDfa(test->dfa);
 	free(test->property);
 	free(test);
 }
@@ -285,7 +401,7 @@ void freePropertyTest(struct PropertyTest * test)
 		break;
 	case PROPERTY_TEST_OP_ATOMIC: {
 		struct AtomicPropertyTest * subTest = test->atomic;
-		free(subTest);
+		free(test);
 		/* allow tail recursion */
 		freeAtomicPropertyTest(subTest);
 	}
@@ -293,6 +409,34 @@ void freePropertyTest(struct PropertyTest * test)
 	}
 }
 
+/** Free a name pattern.
+ * \param pattern name pattern to be freed. May be NULL
+ */
+void freePattern(struct Pattern * pattern)
+{
+	if (!pattern)
+		return;
+
+	freeDfa(pattern->dfa);
+	free(pattern->text);
+	free(pattern);
+}
+
+/** Free a projection.
+ * \param projection projection to be freed. May be NULL
+ */
+void freeProjection(struct Projection * projection)
+{
+	if (!projection)
+		return;
+
+	struct Projection * next = projection->next;
+	free(projection->property);
+	free(projection);
+	/* allow tail recursion */
+	freeProjection(next);
+}
+
 /** Free a node atomic.
  * \param atomic node atomic to be freed. May be NULL
  */
@@ -301,8 +445,9 @@ void freeNodeTest(struct NodeTest * test)
 	if (!test)
 		return;
 
-	free(test->name);
+	freePattern(test->name);
 	freePropertyTest(test->properties);
+	freeProjection(test->projection);
 	struct NodeTest * next = test->subTest;
 	free(test);
 	/* allow tail recursion */
@@ -317,7 +462,9 @@ static const char * testOperators[] = {
 	[ATOMIC_PROPERTY_TEST_OP_GE] = ">=",
 	[ATOMIC_PROPERTY_TEST_OP_LT] = "<",
 	[ATOMIC_PROPERTY_TEST_OP_GT] = ">",
-	[ATOMIC_PROPERTY_TEST_OP_CONTAINS] = "~="
+	[ATOMIC_PROPERTY_TEST_OP_CONTAINS] = "~=",
+	[ATOMIC_PROPERTY_TEST_OP_GLOB] = "%=",
+	[ATOMIC_PROPERTY_TEST_OP_REGEX] = "=~"
 };
 
 /** Dump an atomic property atomic to stdout.
@@ -325,16 +472,17 @@ static const char * testOperators[] = {
  */
 static void printAtomicPropertyTest(const struct AtomicPropertyTest * test)
 {
-	const char * op = testOperators[test->op];
 	switch (test->type) {
 	case ATOMIC_PROPERTY_TEST_TYPE_EXIST:
 		printf("%s", test->property);
 		break;
 	case ATOMIC_PROPERTY_TEST_TYPE_INT:
-		printf("%s %s 0x%x", test->property, op, test->integer);
+		printf("%s %s 0x%x", test->property, testOperators[test->op],
+			test->integer);
 		break;
 	case ATOMIC_PROPERTY_TEST_TYPE_STR:
-		printf("%s %s \"%s\"", test->property, op, test->string);
+		printf("%s %s \"%s\"", test->property, testOperators[test->op],
+			test->string);
 		break;
 	default:
 		assert(false);
@@ -380,8 +528,12 @@ void printNodeTest(const struct NodeTest * test)
 	if (test->type != NODE_TEST_TYPE_ROOT)
 		printf("/");
 
-	if (test->type == NODE_TEST_TYPE_NODE && test->name)
-		printf("%s", test->name);
+	if (test->type == NODE_TEST_TYPE_NODE && test->name) {
+		if (test->name->type == PATTERN_TYPE_REGEX)
+			printf("~\"%s\"", test->name->text);
+		else
+			printf("%s%s", test->name->text, test->name->baseName ? "@" : "");
+	}
 
 	if (test->properties) {
 		printf("[");
@@ -391,4 +543,12 @@ void printNodeTest(const struct NodeTest * test)
 
 	if (test->subTest)
 		printNodeTest(test->subTest);
+
+	if (test->projection) {
+		printf("{");
+		for (const struct Projection * p = test->projection; p; p = p->next)
+			printf(strchr(p->property, ',') ? "\"%s\"%s" : "%s%s",
+				p->property, p->next ? "," : "");
+		printf("}");
+	}
 }
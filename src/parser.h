@@ -2,6 +2,10 @@
 #define _PARSER_H
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+struct Dfa;
 
 /** Data Type of an atomic property test */
 enum ATOMIC_PROPERTY_TEST_TYPE {
@@ -28,7 +32,11 @@ enum ATOMIC_PROPERTY_TEST_OP {
 	/** Test "greater than" */
 	ATOMIC_PROPERTY_TEST_OP_GT,
 	/** Test equality of one element in an array */
-	ATOMIC_PROPERTY_TEST_OP_CONTAINS
+	ATOMIC_PROPERTY_TEST_OP_CONTAINS,
+	/** Test one element of a string array against a glob pattern */
+	ATOMIC_PROPERTY_TEST_OP_GLOB,
+	/** Test one element of a string array against a regular expression */
+	ATOMIC_PROPERTY_TEST_OP_REGEX
 };
 
 /** AST: Atomic Property Test */
@@ -45,6 +53,8 @@ struct AtomicPropertyTest {
 		/** Data to compare to: integer */
 		uint32_t integer;
 	};
+	/** for glob and regex operators: compiled pattern */
+	struct Dfa * dfa;
 };
 
 /** Property test operation */
@@ -77,6 +87,36 @@ struct PropertyTest {
 	};
 };
 
+/** Type of a name pattern */
+enum PATTERN_TYPE {
+	/** Exact name */
+	PATTERN_TYPE_EXACT,
+	/** Glob pattern */
+	PATTERN_TYPE_GLOB,
+	/** Regular expression */
+	PATTERN_TYPE_REGEX
+};
+
+/** AST: Name pattern */
+struct Pattern {
+	/** pattern type */
+	enum PATTERN_TYPE type;
+	/** name or pattern as given in the expression */
+	char * text;
+	/** only match the name without its "@unit-address" */
+	bool baseName;
+	/** for globs and regular expressions: compiled pattern */
+	struct Dfa * dfa;
+};
+
+/** AST: Projection, i.e. list of properties to print for matching nodes */
+struct Projection {
+	/** property name */
+	char * property;
+	/** optional: next property */
+	struct Projection * next;
+};
+
 /** Node Test Type */
 enum NODE_TEST_TYPE {
 	/** Root node */
@@ -92,20 +132,27 @@ struct NodeTest {
 	/** node type */
 	enum NODE_TEST_TYPE type;
 	/** optional: node name to match */
-	char * name;
+	struct Pattern * name;
 	/** optional: node properties */
 	struct PropertyTest * properties;
 	/** optional: child node test. Required for type NODE_TEST_TYPE_DESCEND */
 	struct NodeTest * subTest;
+	/** optional, only for type NODE_TEST_TYPE_ROOT: properties to print */
+	struct Projection * projection;
 };
 
 void lexError(const char * yytext);
 
+void resetLexer(void);
+
 void yyerror(struct NodeTest ** parsedExpression, const char * expr,
 	const char * err);
 
-struct NodeTest * newNodeTest(enum NODE_TEST_TYPE type, char * name,
-	struct PropertyTest * properties, struct NodeTest * subExpr);
+struct NodeTest * newNodeTest(enum NODE_TEST_TYPE type,
+	struct Pattern * name, struct PropertyTest * properties,
+	struct NodeTest * subExpr);
+
+struct Projection * newProjection(char * property, struct Projection * next);
 
 struct PropertyTest * newPropertyTestBinary(enum PROPERTY_TEST_OP op,
 	struct PropertyTest * left, struct PropertyTest * right);
@@ -120,13 +167,28 @@ struct AtomicPropertyTest * newAtomicPropertyTestExist(char * property);
 struct AtomicPropertyTest * newAtomicPropertyTestString(
 	enum ATOMIC_PROPERTY_TEST_OP op, char * property, char * string);
 
+struct AtomicPropertyTest * newAtomicPropertyTestPattern(
+	enum ATOMIC_PROPERTY_TEST_OP op, char * property, char * pattern,
+	const char ** err);
+
 struct AtomicPropertyTest * newAtomicPropertyTestInteger(
 	enum ATOMIC_PROPERTY_TEST_OP op, char * property, int integer);
 
+struct Pattern * newPattern(enum PATTERN_TYPE type, char * text,
+	const char ** err);
+
+bool matchPattern(const struct Pattern * pattern, const char * name, int len);
+
 struct NodeTest * parseNodeTestExpr(const char * expr);
 
+struct NodeTest * parseNodeTestExprErrors(const char * expr, FILE * errors);
+
 void freeNodeTest(struct NodeTest * test);
 
+void freePattern(struct Pattern * pattern);
+
+void freeProjection(struct Projection * projection);
+
 void freeAtomicPropertyTest(struct AtomicPropertyTest * test);
 
 void freePropertyTest(struct PropertyTest * test);
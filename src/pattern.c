@@ -0,0 +1,637 @@
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pattern.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/** Maximum number of DFA states, so that states fit into an int16_t */
+#define DFA_MAX_STATES 1024
+
+/** Type of an NFA state */
+enum NFA_STATE_TYPE {
+	/** Consumes one character of a set */
+	NFA_STATE_TYPE_SET,
+	/** Consumes nothing, up to two successors */
+	NFA_STATE_TYPE_EPSILON,
+	/** Accepting state */
+	NFA_STATE_TYPE_MATCH
+};
+
+/** NFA state */
+struct NfaState {
+	/** state type */
+	enum NFA_STATE_TYPE type;
+	/** successor, -1 if there is none */
+	int out;
+	/** for epsilon states: second successor, -1 if there is none */
+	int out1;
+	/** for set states: set of characters */
+	uint32_t set[8];
+};
+
+/** Non-deterministic finite automaton (Thompson construction) */
+struct Nfa {
+	/** states */
+	struct NfaState * states;
+	/** number of states */
+	int count;
+	/** number of allocated states */
+	int capacity;
+};
+
+/** Part of an NFA with a single entry and a single (epsilon) exit state */
+struct Fragment {
+	/** entry state */
+	int start;
+	/** exit state */
+	int end;
+};
+
+/** Acceptance of a DFA state */
+enum DFA_ACCEPT {
+	/** Not accepting */
+	DFA_ACCEPT_NO,
+	/** Accepting */
+	DFA_ACCEPT_YES,
+	/** Accepting, whatever follows */
+	DFA_ACCEPT_ALWAYS
+};
+
+/** Deterministic finite automaton */
+struct Dfa {
+	/** number of states, state 0 is the start state */
+	int count;
+	/** transitions: next state for each state and character, -1 if the
+	 *  automaton cannot accept anymore
+	 */
+	int16_t * next;
+	/** acceptance of each state */
+	unsigned char * accept;
+};
+
+static int addState(struct Nfa * nfa, enum NFA_STATE_TYPE type)
+{
+	if (nfa->count == nfa->capacity) {
+		nfa->capacity = nfa->capacity ? nfa->capacity * 2 : 16;
+		nfa->states = realloc(nfa->states,
+			nfa->capacity * sizeof *nfa->states);
+		assert(nfa->states);
+	}
+	struct NfaState * state = &nfa->states[nfa->count];
+	state->type = type;
+	state->out = -1;
+	state->out1 = -1;
+	memset(state->set, 0, sizeof state->set);
+	return nfa->count++;
+}
+
+static inline void addChar(uint32_t * set, unsigned char c)
+{
+	set[c / 32] |= 1u << (c % 32);
+}
+
+static inline bool hasChar(const uint32_t * set, unsigned char c)
+{
+	return set[c / 32] & (1u << (c % 32));
+}
+
+/** Fragment matching the empty string */
+static struct Fragment emptyFragment(struct Nfa * nfa)
+{
+	int state = addState(nfa, NFA_STATE_TYPE_EPSILON);
+	return (struct Fragment) { state, state };
+}
+
+/** Fragment matching one character of a set */
+static struct Fragment setFragment(struct Nfa * nfa, const uint32_t * set)
+{
+	int start = addState(nfa, NFA_STATE_TYPE_SET);
+	int end = addState(nfa, NFA_STATE_TYPE_EPSILON);
+	memcpy(nfa->states[start].set, set, sizeof nfa->states[start].set);
+	nfa->states[start].out = end;
+	return (struct Fragment) { start, end };
+}
+
+/** Fragment matching any character */
+static struct Fragment anyFragment(struct Nfa * nfa)
+{
+	uint32_t set[8];
+	memset(set, 0xff, sizeof set);
+	return setFragment(nfa, set);
+}
+
+/** Fragment matching a single character */
+static struct Fragment charFragment(struct Nfa * nfa, unsigned char c)
+{
+	uint32_t set[8] = { 0 };
+	addChar(set, c);
+	return setFragment(nfa, set);
+}
+
+/** Fragment matching a followed by b */
+static struct Fragment concatFragments(struct Nfa * nfa, struct Fragment a,
+	struct Fragment b)
+{
+	nfa->states[a.end].out = b.start;
+	return (struct Fragment) { a.start, b.end };
+}
+
+/** Fragment matching a or b */
+static struct Fragment altFragments(struct Nfa * nfa, struct Fragment a,
+	struct Fragment b)
+{
+	int start = addState(nfa, NFA_STATE_TYPE_EPSILON);
+	int end = addState(nfa, NFA_STATE_TYPE_EPSILON);
+	nfa->states[start].out = a.start;
+	nfa->states[start].out1 = b.start;
+	nfa->states[a.end].out = end;
+	nfa->states[b.end].out = end;
+	return (struct Fragment) { start, end };
+}
+
+/** Fragment matching a repeated: '*' (any times), '+' (at least once) or '?'
+ *  (at most once)
+ */
+static struct Fragment repeatFragment(struct Nfa * nfa, struct Fragment a,
+	char op)
+{
+	int split = addState(nfa, NFA_STATE_TYPE_EPSILON);
+	int end = addState(nfa, NFA_STATE_TYPE_EPSILON);
+	nfa->states[split].out = a.start;
+	nfa->states[split].out1 = end;
+	switch (op) {
+	case '*':
+		nfa->states[a.end].out = split;
+		return (struct Fragment) { split, end };
+	case '+':
+		nfa->states[a.end].out = split;
+		return (struct Fragment) { a.start, end };
+	case '?':
+		nfa->states[a.end].out = end;
+		return (struct Fragment) { split, end };
+	default:
+		assert(false);
+	}
+	return a;
+}
+
+/** State of the pattern parser */
+struct PatternParser {
+	/** NFA being built */
+	struct Nfa nfa;
+	/** next character to be parsed */
+	const char * pos;
+	/** end of the pattern */
+	const char * end;
+	/** nesting depth of groups */
+	int depth;
+	/** error message, NULL as long as there is no error */
+	const char * err;
+};
+
+/** Parse an escaped character (after the backslash).
+ *  Besides any escaped character, the classes \d, \w and \s are known.
+ * \param p parser state
+ * \param set set to add the character(s) to
+ */
+static void parseEscape(struct PatternParser * p, uint32_t * set)
+{
+	if (p->pos == p->end) {
+		p->err = "trailing backslash";
+		return;
+	}
+	unsigned char c = *p->pos++;
+	switch (c) {
+	case 'd':
+		for (c = '0'; c <= '9'; c++)
+			addChar(set, c);
+		break;
+	case 'w':
+		for (c = '0'; c <= '9'; c++)
+			addChar(set, c);
+		for (c = 'a'; c <= 'z'; c++) {
+			addChar(set, c);
+			addChar(set, c - 'a' + 'A');
+		}
+		addChar(set, '_');
+		break;
+	case 's':
+		addChar(set, ' ');
+		addChar(set, '\t');
+		addChar(set, '\n');
+		addChar(set, '\r');
+		addChar(set, '\f');
+		addChar(set, '\v');
+		break;
+	default:
+		addChar(set, c);
+	}
+}
+
+/** Parse a character class (after the opening bracket)
+ * \param p parser state
+ * \param negation characters which negate the class if they come first
+ * \return fragment matching the class
+ */
+static struct Fragment parseClass(struct PatternParser * p,
+	const char * negation)
+{
+	uint32_t set[8] = { 0 };
+	bool negate = false;
+	if (p->pos < p->end && strchr(negation, *p->pos)) {
+		negate = true;
+		p->pos++;
+	}
+
+	/* a closing bracket in the first position is a literal */
+	bool first = true;
+	while (p->pos < p->end && (first || *p->pos != ']')) {
+		first = false;
+		unsigned char c = *p->pos++;
+		if (c == '\\') {
+			parseEscape(p, set);
+			continue;
+		}
+		if (p->pos + 1 < p->end && *p->pos == '-' && p->pos[1] != ']') {
+			/* a range */
+			unsigned char last = p->pos[1];
+			p->pos += 2;
+			if (last < c) {
+				p->err = "invalid range in character class";
+				break;
+			}
+			for (int i = c; i <= last; i++)
+				addChar(set, i);
+		} else {
+			addChar(set, c);
+		}
+	}
+	if (p->pos == p->end) {
+		p->err = "unterminated character class";
+	} else {
+		p->pos++;
+	}
+
+	if (negate)
+		for (int i = 0; i < 8; i++)
+			set[i] = ~set[i];
+	return setFragment(&p->nfa, set);
+}
+
+static struct Fragment parseAlternation(struct PatternParser * p);
+
+/** Parse an atom of a regular expression */
+static struct Fragment parseAtom(struct PatternParser * p)
+{
+	char c = *p->pos++;
+	switch (c) {
+	case '(': {
+		p->depth++;
+		struct Fragment f = parseAlternation(p);
+		p->depth--;
+		if (p->pos == p->end || *p->pos != ')')
+			p->err = "missing ')'";
+		else
+			p->pos++;
+		return f;
+	}
+	case '.':
+		return anyFragment(&p->nfa);
+	case '[':
+		return parseClass(p, "^");
+	case '\\': {
+		uint32_t set[8] = { 0 };
+		parseEscape(p, set);
+		return setFragment(&p->nfa, set);
+	}
+	case '*':
+	case '+':
+	case '?':
+		p->err = "nothing to repeat";
+		return emptyFragment(&p->nfa);
+	case '^':
+	case '$':
+		p->err = "anchors are only supported at the start or end of a "
+			"top-level alternative";
+		return emptyFragment(&p->nfa);
+	case '{':
+		p->err = "intervals are not supported";
+		return emptyFragment(&p->nfa);
+	default:
+		return charFragment(&p->nfa, c);
+	}
+}
+
+/** Check whether the parser is at a '$' anchoring a top-level alternative */
+static bool atEndAnchor(const struct PatternParser * p)
+{
+	return !p->depth && p->pos < p->end && *p->pos == '$' &&
+		(p->pos + 1 == p->end || p->pos[1] == '|');
+}
+
+/** Parse a sequence of (repeated) atoms of a regular expression */
+static struct Fragment parseSequence(struct PatternParser * p)
+{
+	struct Fragment f = emptyFragment(&p->nfa);
+	while (!p->err && p->pos < p->end && *p->pos != '|' && *p->pos != ')' &&
+		!atEndAnchor(p)) {
+		struct Fragment atom = parseAtom(p);
+		while (p->pos < p->end && strchr("*+?", *p->pos))
+			atom = repeatFragment(&p->nfa, atom, *p->pos++);
+		f = concatFragments(&p->nfa, f, atom);
+	}
+	return f;
+}
+
+/** Parse alternatives of a regular expression */
+static struct Fragment parseAlternation(struct PatternParser * p)
+{
+	struct Fragment f = parseSequence(p);
+	while (!p->err && p->pos < p->end && *p->pos == '|') {
+		p->pos++;
+		f = altFragments(&p->nfa, f, parseSequence(p));
+	}
+	return f;
+}
+
+/** Add a state and its epsilon closure to a set of NFA states
+ * \param nfa automaton
+ * \param set set of states
+ * \param state state to be added
+ * \param stack scratch space for nfa->count states
+ */
+static void addClosure(const struct Nfa * nfa, uint64_t * set, int state,
+	int * stack)
+{
+	int top = 0;
+	if (set[state / 64] & (1ull << (state % 64)))
+		return;
+	set[state / 64] |= 1ull << (state % 64);
+	stack[top++] = state;
+	while (top) {
+		const struct NfaState * s = &nfa->states[stack[--top]];
+		if (s->type != NFA_STATE_TYPE_EPSILON)
+			continue;
+		int outs[2] = { s->out, s->out1 };
+		for (int i = 0; i < 2; i++) {
+			int out = outs[i];
+			if (out < 0 || (set[out / 64] & (1ull << (out % 64))))
+				continue;
+			set[out / 64] |= 1ull << (out % 64);
+			stack[top++] = out;
+		}
+	}
+}
+
+/** Convert an NFA into a DFA (subset construction)
+ * \param nfa automaton, its last state is the only accepting one
+ * \param start start state of the NFA
+ * \param err error message in case of failure
+ * \return DFA or NULL if it would get too big
+ */
+static struct Dfa * buildDfa(const struct Nfa * nfa, int start,
+	const char ** err)
+{
+	int words = (nfa->count + 63) / 64;
+	int capacity = 16;
+	uint64_t * sets = calloc(capacity * words, sizeof *sets);
+	int * stack = malloc(nfa->count * sizeof *stack);
+	uint64_t * target = malloc(words * sizeof *target);
+	struct Dfa * dfa = malloc(sizeof *dfa);
+	assert(sets && stack && target && dfa);
+	dfa->next = malloc(capacity * 256 * sizeof *dfa->next);
+	dfa->accept = malloc(capacity * sizeof *dfa->accept);
+	assert(dfa->next && dfa->accept);
+
+	addClosure(nfa, sets, start, stack);
+	dfa->count = 1;
+
+	for (int current = 0; current < dfa->count; current++) {
+		for (int c = 0; c < 256; c++) {
+			/* states reachable by consuming c */
+			memset(target, 0, words * sizeof *target);
+			bool empty = true;
+			for (int s = 0; s < nfa->count; s++) {
+				if (!(sets[current * words + s / 64] & (1ull << (s % 64))))
+					continue;
+				const struct NfaState * state = &nfa->states[s];
+				if (state->type == NFA_STATE_TYPE_SET &&
+					hasChar(state->set, c)) {
+					addClosure(nfa, target, state->out, stack);
+					empty = false;
+				}
+			}
+			if (empty) {
+				dfa->next[current * 256 + c] = -1;
+				continue;
+			}
+
+			/* look for an existing DFA state */
+			int next;
+			for (next = 0; next < dfa->count; next++)
+				if (!memcmp(&sets[next * words], target,
+					words * sizeof *target))
+					break;
+			if (next == dfa->count) {
+				if (dfa->count == DFA_MAX_STATES) {
+					*err = "pattern too complex";
+					free(sets);
+					free(stack);
+					free(target);
+					freeDfa(dfa);
+					return NULL;
+				}
+				if (dfa->count == capacity) {
+					capacity *= 2;
+					sets = realloc(sets, capacity * words * sizeof *sets);
+					dfa->next = realloc(dfa->next,
+						capacity * 256 * sizeof *dfa->next);
+					dfa->accept = realloc(dfa->accept,
+						capacity * sizeof *dfa->accept);
+					assert(sets && dfa->next && dfa->accept);
+				}
+				memcpy(&sets[next * words], target, words * sizeof *target);
+				dfa->count++;
+			}
+			dfa->next[current * 256 + c] = next;
+		}
+	}
+
+	/* accepting states contain the accepting NFA state */
+	int match = nfa->count - 1;
+	for (int i = 0; i < dfa->count; i++) {
+		dfa->accept[i] = DFA_ACCEPT_NO;
+		if (!(sets[i * words + match / 64] & (1ull << (match % 64))))
+			continue;
+		dfa->accept[i] = DFA_ACCEPT_ALWAYS;
+		for (int c = 0; c < 256; c++)
+			if (dfa->next[i * 256 + c] != i)
+				dfa->accept[i] = DFA_ACCEPT_YES;
+	}
+
+	free(sets);
+	free(stack);
+	free(target);
+	return dfa;
+}
+
+/** Finish an NFA and convert it into a DFA
+ * \param p parser state
+ * \param f fragment of the whole pattern
+ * \param err error message in case of failure
+ * \return DFA or NULL in case of failure
+ */
+static struct Dfa * finishPattern(struct PatternParser * p,
+	struct Fragment f, const char ** err)
+{
+	struct Dfa * dfa = NULL;
+	if (p->err) {
+		*err = p->err;
+	} else {
+		int match = addState(&p->nfa, NFA_STATE_TYPE_MATCH);
+		p->nfa.states[f.end].out = match;
+		dfa = buildDfa(&p->nfa, f.start, err);
+	}
+	free(p->nfa.states);
+	return dfa;
+}
+
+/** Compile a glob pattern into a DFA.
+ *  A glob matches a whole string. It supports '*' (any characters), '?' (any
+ *  character), character classes ("[a-z]", "[!0-9]") and escapes ('\').
+ * \param glob glob pattern
+ * \param err error message in case of failure
+ * \return DFA or NULL in case of failure
+ */
+struct Dfa * compileGlob(const char * glob, const char ** err)
+{
+	struct PatternParser p = {
+		.pos = glob,
+		.end = glob + strlen(glob),
+	};
+
+	struct Fragment f = emptyFragment(&p.nfa);
+	while (!p.err && p.pos < p.end) {
+		char c = *p.pos++;
+		struct Fragment next;
+		switch (c) {
+		case '*':
+			next = repeatFragment(&p.nfa, anyFragment(&p.nfa), '*');
+			break;
+		case '?':
+			next = anyFragment(&p.nfa);
+			break;
+		case '[':
+			next = parseClass(&p, "!^");
+			break;
+		case '\\': {
+			uint32_t set[8] = { 0 };
+			if (p.pos == p.end)
+				p.err = "trailing backslash";
+			else
+				addChar(set, *p.pos++);
+			next = setFragment(&p.nfa, set);
+		}
+			break;
+		default:
+			next = charFragment(&p.nfa, c);
+		}
+		f = concatFragments(&p.nfa, f, next);
+	}
+
+	return finishPattern(&p, f, err);
+}
+
+/** Parse a top-level alternative of a regular expression, which may be
+ *  anchored by '^' at its start and by '$' at its end. Unanchored ends match
+ *  any characters.
+ * \param p parser state
+ * \return fragment matching the alternative
+ */
+static struct Fragment parseAnchoredSequence(struct PatternParser * p)
+{
+	bool anchorStart = p->pos < p->end && *p->pos == '^';
+	if (anchorStart)
+		p->pos++;
+
+	struct Fragment f = parseSequence(p);
+
+	bool anchorEnd = atEndAnchor(p);
+	if (anchorEnd)
+		p->pos++;
+
+	if (!anchorStart)
+		f = concatFragments(&p->nfa,
+			repeatFragment(&p->nfa, anyFragment(&p->nfa), '*'), f);
+	if (!anchorEnd)
+		f = concatFragments(&p->nfa, f,
+			repeatFragment(&p->nfa, anyFragment(&p->nfa), '*'));
+	return f;
+}
+
+/** Compile an extended regular expression into a DFA.
+ *  It supports alternatives ('|'), groups, '*', '+', '?', '.', character
+ *  classes, escapes and the classes \d, \w and \s. Like grep, it matches any
+ *  part of a string, unless an alternative is anchored by '^' at its start
+ *  or by '$' at its end. Unlike grep, anchors are only supported there, i.e.
+ *  not within groups, and intervals ('{n,m}') are not supported at all; both
+ *  are rejected. As there are no back references, matching never backtracks.
+ * \param regex regular expression
+ * \param err error message in case of failure
+ * \return DFA or NULL in case of failure
+ */
+struct Dfa * compileRegex(const char * regex, const char ** err)
+{
+	struct PatternParser p = {
+		.pos = regex,
+		.end = regex + strlen(regex),
+	};
+
+	struct Fragment f = parseAnchoredSequence(&p);
+	while (!p.err && p.pos < p.end && *p.pos == '|') {
+		p.pos++;
+		f = altFragments(&p.nfa, f, parseAnchoredSequence(&p));
+	}
+	if (!p.err && p.pos < p.end)
+		p.err = "unmatched ')'";
+
+	return finishPattern(&p, f, err);
+}
+
+/** Match a string against a DFA, in linear time and without allocations
+ * \param dfa automaton
+ * \param str string, not necessarily terminated
+ * \param len length of the string
+ * \return true if the automaton accepts the string
+ */
+bool matchDfa(const struct Dfa * dfa, const char * str, size_t len)
+{
+	int state = 0;
+	for (size_t i = 0; i < len; i++) {
+		if (dfa->accept[state] == DFA_ACCEPT_ALWAYS)
+			return true;
+		state = dfa->next[state * 256 + (unsigned char)str[i]];
+		if (state < 0)
+			return false;
+	}
+	return dfa->accept[state] != DFA_ACCEPT_NO;
+}
+
+/** Free a DFA
+ * \param dfa automaton to be freed. May be NULL
+ */
+void freeDfa(struct Dfa * dfa)
+{
+	if (!dfa)
+		return;
+
+	free(dfa->next);
+	free(dfa->accept);
+	free(dfa);
+}
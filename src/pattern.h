@@ -0,0 +1,17 @@
+#ifndef _PATTERN_H
+#define _PATTERN_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+struct Dfa;
+
+struct Dfa * compileGlob(const char * glob, const char ** err);
+
+struct Dfa * compileRegex(const char * regex, const char ** err);
+
+bool matchDfa(const struct Dfa * dfa, const char * str, size_t len);
+
+void freeDfa(struct Dfa * dfa);
+
+#endif
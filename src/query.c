@@ -4,15 +4,38 @@
 #endif
 
 #include <parser.h>
+#include <pattern.h>
+#include <query.h>
 #include <stdbool.h>
 #include <libfdt.h>
 #include <stdint.h>
 #include <limits.h>
+#include <ctype.h>
 #include <stdio.h>
 #include <assert.h>
 
-static void printPath(const void * fdt, int offset);
-static void query(const void * fdt, int offset, int depth,
+/** State of a running query */
+struct QueryContext {
+	/** flattened device tree */
+	const void * fdt;
+	/** action for each node satisfying the test */
+	QueryAction action;
+	/** user data for the action */
+	void * data;
+};
+
+/** Options of the default action */
+struct PrintOptions {
+	/** optional: label to prefix each path with */
+	const char * label;
+	/** optional: properties to print */
+	const struct Projection * projection;
+	/** output stream */
+	FILE * out;
+};
+
+static void printPath(const void * fdt, int offset, void * data);
+static void query(const struct QueryContext * ctx, int offset, int depth,
 	const struct NodeTest * test);
 
 static bool containsString(const char * data, int len, const char * str)
@@ -27,6 +50,22 @@ static bool containsString(const char * data, int len, const char * str)
 	return false;
 }
 
+static bool containsMatch(const char * data, int len, const struct Dfa * dfa)
+{
+	const char * end = data + len;
+
+	while (data < end) {
+		const char * str = data;
+		data = memchr(str, '\0', end - str);
+		if (!data)
+			data = end;
+		if (matchDfa(dfa, str, data - str))
+			return true;
+		data++;
+	}
+	return false;
+}
+
 static bool containsInt(const char * data, int len, uint32_t i)
 {
 	const char * end = data + len;
@@ -73,6 +112,9 @@ static bool queryAtomicPropertyTest(const void * fdt, int offset,
 	case ATOMIC_PROPERTY_TEST_TYPE_STR:
 		if (test->op == ATOMIC_PROPERTY_TEST_OP_CONTAINS) {
 			return containsString(prop->data, len, test->string);
+		} else if (test->op == ATOMIC_PROPERTY_TEST_OP_GLOB ||
+			test->op == ATOMIC_PROPERTY_TEST_OP_REGEX) {
+			return containsMatch(prop->data, len, test->dfa);
 		} else {
 			bool res = len == strlen(test->string) + 1;
 			res = res && !memcmp(test->string, prop->data, len);
@@ -136,44 +178,63 @@ int fdt_next_subnode(const void *fdt, int offset)
 }
 #endif
 
+/** Test the name of a node.
+ * \param fdt flattened device tree
+ * \param offset offset to the node
+ * \param test node test
+ * \return true if the test has no name or the name matches
+ */
+static bool matchName(const void * fdt, int offset,
+	const struct NodeTest * test)
+{
+	if (!test->name)
+		return true;
+	int len;
+	const char * name = fdt_get_name(fdt, offset, &len);
+	return matchPattern(test->name, name, len);
+}
+
 /** Test a node which is already a candidate for the overall test or for
  * further recursion.
- * \param fdt flattened device tree
+ * \param ctx query context
  * \param offset offset to the current node
  * \param depth depth of the current node
  * \param test current node test
  */
-static void queryNode(const void * fdt, int offset, int depth,
+static void queryNode(const struct QueryContext * ctx, int offset, int depth,
 	const struct NodeTest * test)
 {
 	/* test properties if there are some */
-	if (test->properties && !queryPropertyTest(fdt, offset, test->properties))
+	if (test->properties &&
+		!queryPropertyTest(ctx->fdt, offset, test->properties))
 		return;
 	if (test->subTest) {
 		/* not a leaf in the test: recurse */
-		query(fdt, offset, depth, test->subTest);
+		query(ctx, offset, depth, test->subTest);
 	} else {
 		/* leaf of the test: action */
-		printPath(fdt, offset);
+		ctx->action(ctx->fdt, offset, ctx->data);
 	}
 }
 
 /** Query a fdt: for each node which satisfies the node test, do an action
- * \param fdt flattened device tree
+ * \param ctx query context
  * \param offset offset to the current node
  * \param depth current node depth
  * \param test current node test
  */
-static void query(const void * fdt, int offset, int depth,
+static void query(const struct QueryContext * ctx, int offset, int depth,
 	const struct NodeTest * test)
 {
+	const void * fdt = ctx->fdt;
+
 	switch (test->type) {
 	case NODE_TEST_TYPE_ROOT:
 		/* root node test is satisfied if and only if the offset points to
 		 * the root node
 		 */
 		if (offset == 0)
-			queryNode(fdt, offset, depth + 1, test);
+			queryNode(ctx, offset, depth + 1, test);
 		break;
 	case NODE_TEST_TYPE_NODE:
 		/* iterate over all direct sub nodes of the given node */
@@ -182,9 +243,8 @@ static void query(const void * fdt, int offset, int depth,
 			/* if the current node has a matching name, test the properties
 			 * and maybe recurse
 			 */
-			if (!test->name ||
-				!strcmp(test->name, fdt_get_name(fdt, offset, NULL)))
-				queryNode(fdt, offset, depth + 1, test);
+			if (matchName(fdt, offset, test))
+				queryNode(ctx, offset, depth + 1, test);
 			offset = fdt_next_subnode(fdt, offset);
 		}
 		break;
@@ -198,33 +258,224 @@ static void query(const void * fdt, int offset, int depth,
 			if (offset < 0 || cdepth < 1)
 				return;
 
-			queryNode(fdt, offset, depth + cdepth, test);
+			if (matchName(fdt, offset, test))
+				queryNode(ctx, offset, depth + cdepth, test);
 		}
 	}
 		break;
 	}
 }
 
+/** Query a fdt: for each node which satisfies the node test, print its path
+ * \param fdt flattened device tree
+ * \param test node test
+ * \param label optional: label to prefix each path with
+ * \param out output stream
+ */
+void queryFdt(const void * fdt, const struct NodeTest * test,
+	const char * label, FILE * out)
+{
+	struct PrintOptions options = {
+		.label = label,
+		.projection = test->projection,
+		.out = out,
+	};
+	queryFdtAction(fdt, test, printPath, &options);
+}
+
 /** Query a fdt: for each node which satisfies the node test, do an action
  * \param fdt flattened device tree
  * \param test node test
+ * \param action action for each matching node
+ * \param data user data passed to the action
  */
-void queryFdt(const void * fdt, const struct NodeTest * test)
+void queryFdtAction(const void * fdt, const struct NodeTest * test,
+	QueryAction action, void * data)
 {
+	struct QueryContext ctx = {
+		.fdt = fdt,
+		.action = action,
+		.data = data,
+	};
 	/* start at root node and depth 0 */
-	query(fdt, 0, 0, test);
+	query(&ctx, 0, 0, test);
+}
+
+static bool matchStep(const void * fdt, const int * chain, int depth,
+	int pos, const struct NodeTest * test);
+
+/** Test a node of a chain against a node test and continue with the sub test.
+ * \param fdt flattened device tree
+ * \param chain offsets of the nodes from the root node down to the tested one
+ * \param depth depth of the tested node, i.e. the last index of the chain
+ * \param pos index of the node in the chain
+ * \param test node test for this node
+ * \return true if the test and all of its sub tests match
+ */
+static bool matchChain(const void * fdt, const int * chain, int depth,
+	int pos, const struct NodeTest * test)
+{
+	if (!matchName(fdt, chain[pos], test))
+		return false;
+	if (test->properties &&
+		!queryPropertyTest(fdt, chain[pos], test->properties))
+		return false;
+	if (test->subTest)
+		return matchStep(fdt, chain, depth, pos, test->subTest);
+	/* leaf of the test: it has to be the tested node */
+	return pos == depth;
+}
+
+/** Test the nodes below a node of a chain against a node test.
+ * \param fdt flattened device tree
+ * \param chain offsets of the nodes from the root node down to the tested one
+ * \param depth depth of the tested node, i.e. the last index of the chain
+ * \param pos index of the node in the chain, the test applies to its children
+ * \param test node test
+ * \return true if the test matches
+ */
+static bool matchStep(const void * fdt, const int * chain, int depth,
+	int pos, const struct NodeTest * test)
+{
+	switch (test->type) {
+	case NODE_TEST_TYPE_ROOT:
+		return false;
+	case NODE_TEST_TYPE_NODE:
+		return pos < depth && matchChain(fdt, chain, depth, pos + 1, test);
+	case NODE_TEST_TYPE_DESCEND:
+		/* the sub test may match at any node below */
+		for (int i = pos + 1; i <= depth; i++)
+			if (matchChain(fdt, chain, depth, i, test->subTest))
+				return true;
+		return false;
+	}
+	return false;
+}
+
+/** Test whether a single node satisfies a node test, without a full query.
+ *  As tests only look at a node and its ancestors, this gives the same
+ *  result as queryFdt() gives for this node.
+ * \param fdt flattened device tree
+ * \param chain offsets of the nodes from the root node down to the tested one
+ * \param depth depth of the tested node, i.e. the last index of the chain
+ * \param test node test
+ * \return true if the node satisfies the test
+ */
+bool queryMatchesNode(const void * fdt, const int * chain, int depth,
+	const struct NodeTest * test)
+{
+	assert(test->type == NODE_TEST_TYPE_ROOT);
+	return matchChain(fdt, chain, depth, 0, test);
+}
+
+/** Test whether a property value looks like a list of strings
+ * \param data property value
+ * \param len length of the value
+ * \return true if it consists of non-empty printable strings
+ */
+static bool isStringList(const char * data, int len)
+{
+	if (!len || data[len - 1])
+		return false;
+
+	for (int i = 0; i < len; i++) {
+		if (!data[i]) {
+			/* no empty strings */
+			if (!i || !data[i - 1])
+				return false;
+		} else if (!isprint((unsigned char)data[i])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/** Print a quoted string, escaping quotes and backslashes like dtc does.
+ *  Other characters are printable, see isStringList().
+ * \param out output stream
+ * \param str string
+ */
+static void printString(FILE * out, const char * str)
+{
+	fputc('"', out);
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\')
+			fputc('\\', out);
+		fputc(*str, out);
+	}
+	fputc('"', out);
+}
+
+/** Print a property value, decoded like dtc does: as a list of strings, as
+ *  cells or as bytes.
+ * \param out output stream
+ * \param data property value
+ * \param len length of the value
+ */
+static void printValue(FILE * out, const char * data, int len)
+{
+	if (isStringList(data, len)) {
+		for (const char * str = data; str < data + len;
+			str += strlen(str) + 1) {
+			if (str != data)
+				fputs(", ", out);
+			printString(out, str);
+		}
+	} else if (len % 4 == 0) {
+		fputc('<', out);
+		for (int i = 0; i < len; i += 4)
+			fprintf(out, "%s0x%x", i ? " " : "",
+				fdt32_to_cpu(*(const fdt32_t *)(data + i)));
+		fputc('>', out);
+	} else {
+		fputc('[', out);
+		for (int i = 0; i < len; i++)
+			fprintf(out, "%s%02x", i ? " " : "", (unsigned char)data[i]);
+		fputc(']', out);
+	}
+}
+
+/** Print the projected properties of a node. Missing properties are
+ *  skipped.
+ * \param out output stream
+ * \param fdt flattened device tree
+ * \param offset offset to node
+ * \param projection properties to print
+ */
+static void printProjection(FILE * out, const void * fdt, int offset,
+	const struct Projection * projection)
+{
+	for (; projection; projection = projection->next) {
+		int len;
+		const char * data = fdt_getprop(fdt, offset, projection->property,
+			&len);
+		if (!data)
+			continue;
+		fprintf(out, "\t%s", projection->property);
+		if (len) {
+			fputs(" = ", out);
+			printValue(out, data, len);
+		}
+		fputs(";\n", out);
+	}
 }
 
 /** Print a path of a node in the device tree.
- *  This is the only action right now.
+ *  This is the default action.
  * \param fdt flattened device tree
  * \param offset offset to node
+ * \param data print options
  */
-static void printPath(const void * fdt, int offset)
+static void printPath(const void * fdt, int offset, void * data)
 {
+	const struct PrintOptions * options = data;
 	char path[PATH_MAX];
 	fdt_get_path(fdt, offset, path, sizeof path);
-	printf("Node: %s @ %d: %s\n", fdt_get_name(fdt, offset, NULL), offset,
-		path);
+	if (options->label)
+		fprintf(options->out, "%s: ", options->label);
+	fprintf(options->out, "Node: %s @ %d: %s\n",
+		fdt_get_name(fdt, offset, NULL), offset, path);
+	/* print the properties while the node is still in the cache */
+	printProjection(options->out, fdt, offset, options->projection);
 }
 
@@ -2,7 +2,23 @@
 #define _QUERY_H
 
 #include <parser.h>
+#include <stdbool.h>
+#include <stdio.h>
 
-void queryFdt(const void * fdt, const struct NodeTest * test);
+/** Action to be done for each node which satisfies a node test
+ * \param fdt flattened device tree
+ * \param offset offset to the matching node
+ * \param data user data
+ */
+typedef void (*QueryAction)(const void * fdt, int offset, void * data);
+
+void queryFdt(const void * fdt, const struct NodeTest * test,
+	const char * label, FILE * out);
+
+void queryFdtAction(const void * fdt, const struct NodeTest * test,
+	QueryAction action, void * data);
+
+bool queryMatchesNode(const void * fdt, const int * chain, int depth,
+	const struct NodeTest * test);
 
 #endif
@@ -0,0 +1,586 @@
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <serve.h>
+#include <blob.h>
+#include <hash.h>
+#include <query.h>
+#include <parser.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <assert.h>
+#include <errno.h>
+#include <error.h>
+
+/* Protocol: a request is a line "<filename>\t<query>\n", where filename is
+ * one of the files given to the server. The response consists of the usual
+ * query output, or of a line "Error: <message>" (possibly followed by more
+ * lines of the message), and is terminated by an empty line. Several requests
+ * can be sent over one connection.
+ */
+
+/** Maximum length of a request line */
+#define MAX_REQUEST 4096
+
+/** Number of buckets of the query cache */
+#define QUERY_CACHE_BUCKETS 256
+
+/** Maximum number of cached queries, further queries are compiled for each
+ *  request
+ */
+#define QUERY_CACHE_MAX 4096
+
+/** Time in seconds a worker may spend on sending the responses to the
+ *  requests it took from a client at once. A client which does not read its
+ *  responses (or reads them very slowly) would block the worker otherwise.
+ */
+#define SEND_TIMEOUT 10
+
+/** A compiled query in the cache */
+struct CachedQuery {
+	/** query expression */
+	char * expr;
+	/** compiled query */
+	struct NodeTest * test;
+	/** next query in the same bucket */
+	struct CachedQuery * next;
+};
+
+/** A client connection.
+ *  It is owned either by the main thread (waiting for a request) or by one
+ *  worker (processing requests), never by both.
+ */
+struct Connection {
+	/** socket */
+	int fd;
+	/** output stream on the socket */
+	FILE * out;
+	/** deadline for sending the current responses (CLOCK_MONOTONIC) */
+	struct timespec deadline;
+	/** set if sending failed or timed out, further output is discarded */
+	bool broken;
+	/** received data which has not been processed yet */
+	char buffer[MAX_REQUEST];
+	/** length of the received data */
+	size_t len;
+	/** next connection in the job queue */
+	struct Connection * next;
+};
+
+/** State of the server */
+struct Server {
+	/** preloaded blobs */
+	struct Blob * blobs;
+	/** number of preloaded blobs */
+	int count;
+	/** epoll instance */
+	int epoll;
+	/** compiled queries, by expression */
+	struct CachedQuery * cache[QUERY_CACHE_BUCKETS];
+	/** number of compiled queries */
+	int cached;
+	/** protects the cache and the (non-reentrant) parser */
+	pthread_mutex_t cacheLock;
+	/** connections with pending requests */
+	struct Connection * jobs;
+	/** last connection with pending requests */
+	struct Connection * lastJob;
+	/** protects the job queue */
+	pthread_mutex_t jobLock;
+	/** signals new jobs */
+	pthread_cond_t jobCond;
+};
+
+/** Wait for events of a connection (again)
+ * \param server server state
+ * \param conn connection
+ * \param op EPOLL_CTL_ADD or EPOLL_CTL_MOD
+ * \return true on success
+ */
+static bool armConnection(struct Server * server, struct Connection * conn,
+	int op)
+{
+	/* one shot: the connection is handed over to a worker on an event */
+	struct epoll_event event = {
+		.events = EPOLLIN | EPOLLONESHOT,
+		.data.ptr = conn,
+	};
+	return epoll_ctl(server->epoll, op, conn->fd, &event) == 0;
+}
+
+/** Get the time left until a deadline
+ * \param deadline deadline (CLOCK_MONOTONIC)
+ * \return time left in milliseconds, at most 0 if the deadline has passed
+ */
+static long timeLeft(const struct timespec * deadline)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (deadline->tv_sec - now.tv_sec) * 1000 +
+		(deadline->tv_nsec - now.tv_nsec) / 1000000;
+}
+
+/** Write function of the output stream of a connection.
+ *  Sending has to be finished by the deadline of the connection. Once it
+ *  failed, nothing is sent anymore, so a stalled client costs at most one
+ *  timeout.
+ * \param cookie connection
+ * \param buf data to be sent
+ * \param size size of the data
+ * \return number of bytes sent, 0 in case of an error
+ */
+static ssize_t writeConnection(void * cookie, const char * buf, size_t size)
+{
+	struct Connection * conn = cookie;
+	while (!conn->broken) {
+		long left = timeLeft(&conn->deadline);
+		struct pollfd pfd = {
+			.fd = conn->fd,
+			.events = POLLOUT,
+		};
+		int ready = left > 0 ? poll(&pfd, 1, left) : 0;
+		if (ready < 0 && errno == EINTR)
+			continue;
+		if (ready <= 0) {
+			/* timed out or failed */
+			conn->broken = true;
+			break;
+		}
+
+		ssize_t len = send(conn->fd, buf, size, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (len < 0 && (errno == EINTR || errno == EAGAIN))
+			continue;
+		if (len <= 0) {
+			conn->broken = true;
+			break;
+		}
+		return len;
+	}
+	return 0;
+}
+
+/** Close a connection
+ * \param conn connection to be closed
+ */
+static void closeConnection(struct Connection * conn)
+{
+	fclose(conn->out);
+	close(conn->fd);
+	free(conn);
+}
+
+/** Get a compiled query, compile and cache it if necessary
+ * \param server server state
+ * \param expr query expression
+ * \param cached set to true if the query is cached, i.e. must not be freed
+ * \param err set to the parser's messages if the expression is invalid, to
+ *  be freed by the caller
+ * \return compiled query or NULL if the expression is invalid
+ */
+static struct NodeTest * getQuery(struct Server * server, const char * expr,
+	bool * cached, char ** err)
+{
+	size_t len = strlen(expr);
+	size_t bucket = hashBytes(HASH_SEED, expr, len) % QUERY_CACHE_BUCKETS;
+
+	pthread_mutex_lock(&server->cacheLock);
+	for (struct CachedQuery * q = server->cache[bucket]; q; q = q->next) {
+		if (!strcmp(q->expr, expr)) {
+			pthread_mutex_unlock(&server->cacheLock);
+			*cached = true;
+			*err = NULL;
+			return q->test;
+		}
+	}
+
+	/* collect the messages for the client instead of printing them */
+	size_t errLen;
+	FILE * errors = open_memstream(err, &errLen);
+	assert(errors);
+	struct NodeTest * test = parseNodeTestExprErrors(expr, errors);
+	fclose(errors);
+	if (test) {
+		free(*err);
+		*err = NULL;
+	}
+
+	*cached = test && server->cached < QUERY_CACHE_MAX;
+	if (*cached) {
+		struct CachedQuery * q = malloc(sizeof *q);
+		assert(q);
+		q->expr = strdup(expr);
+		assert(q->expr);
+		q->test = test;
+		q->next = server->cache[bucket];
+		server->cache[bucket] = q;
+		server->cached++;
+	}
+	pthread_mutex_unlock(&server->cacheLock);
+	return test;
+}
+
+/** Send the messages of the parser as an error response. The first line is
+ *  the error line, further lines (e.g. marking the error in the expression)
+ *  follow it.
+ * \param conn connection
+ * \param err messages of the parser, one per line
+ */
+static void sendParseError(struct Connection * conn, const char * err)
+{
+	fputs("Error: ", conn->out);
+	bool empty = true;
+	for (const char * line = err; *line; ) {
+		size_t len = strcspn(line, "\n");
+		/* an empty line would terminate the response */
+		if (len) {
+			fprintf(conn->out, "%.*s\n", (int)len, line);
+			empty = false;
+		}
+		line += len;
+		if (*line)
+			line++;
+	}
+	if (empty)
+		fputs("invalid query\n", conn->out);
+	fputc('\n', conn->out);
+}
+
+/** Process a request and stream the response
+ * \param server server state
+ * \param conn connection
+ * \param request request line, without the line break
+ */
+static void handleRequest(struct Server * server, struct Connection * conn,
+	char * request)
+{
+	char * expr = strchr(request, '\t');
+	if (!expr) {
+		fputs("Error: malformed request\n\n", conn->out);
+		return;
+	}
+	*expr++ = '\0';
+
+	const struct Blob * blob = NULL;
+	for (int i = 0; i < server->count && !blob; i++)
+		if (!strcmp(server->blobs[i].filename, request))
+			blob = &server->blobs[i];
+	if (!blob) {
+		fprintf(conn->out, "Error: unknown file '%s'\n\n", request);
+		return;
+	}
+
+	bool cached;
+	char * err;
+	struct NodeTest * test = getQuery(server, expr, &cached, &err);
+	if (!test) {
+		sendParseError(conn, err);
+		free(err);
+		return;
+	}
+
+	queryFdt(blob->fdt, test, NULL, conn->out);
+	fputc('\n', conn->out);
+
+	if (!cached)
+		freeNodeTest(test);
+}
+
+/** Worker: process the requests of connections from the job queue
+ * \param data server state
+ * \return nothing
+ */
+static void * worker(void * data)
+{
+	struct Server * server = data;
+
+	while (true) {
+		pthread_mutex_lock(&server->jobLock);
+		while (!server->jobs)
+			pthread_cond_wait(&server->jobCond, &server->jobLock);
+		struct Connection * conn = server->jobs;
+		server->jobs = conn->next;
+		pthread_mutex_unlock(&server->jobLock);
+
+		/* one deadline for all responses, not for each send */
+		clock_gettime(CLOCK_MONOTONIC, &conn->deadline);
+		conn->deadline.tv_sec += SEND_TIMEOUT;
+
+		/* process all complete requests */
+		char * end;
+		while (!conn->broken &&
+			(end = memchr(conn->buffer, '\n', conn->len))) {
+			*end = '\0';
+			handleRequest(server, conn, conn->buffer);
+			size_t used = end + 1 - conn->buffer;
+			conn->len -= used;
+			memmove(conn->buffer, end + 1, conn->len);
+		}
+
+		/* hand the connection back to the main thread */
+		if (fflush(conn->out) || conn->broken ||
+			!armConnection(server, conn, EPOLL_CTL_MOD))
+			closeConnection(conn);
+	}
+	return NULL;
+}
+
+/** Queue a connection with pending requests
+ * \param server server state
+ * \param conn connection
+ */
+static void addJob(struct Server * server, struct Connection * conn)
+{
+	conn->next = NULL;
+	pthread_mutex_lock(&server->jobLock);
+	if (server->jobs)
+		server->lastJob->next = conn;
+	else
+		server->jobs = conn;
+	server->lastJob = conn;
+	pthread_cond_signal(&server->jobCond);
+	pthread_mutex_unlock(&server->jobLock);
+}
+
+/** Accept a new connection
+ * \param server server state
+ * \param listener listening socket
+ */
+static void acceptConnection(struct Server * server, int listener)
+{
+	int fd = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	struct Connection * conn = malloc(sizeof *conn);
+	assert(conn);
+	conn->fd = fd;
+	conn->len = 0;
+	conn->deadline = (struct timespec) { 0 };
+	conn->broken = false;
+	conn->out = fopencookie(conn, "w", (cookie_io_functions_t) {
+		.write = writeConnection,
+	});
+	if (!conn->out) {
+		close(fd);
+		free(conn);
+		return;
+	}
+	if (!armConnection(server, conn, EPOLL_CTL_ADD))
+		closeConnection(conn);
+}
+
+/** Close a connection after sending a final response.
+ *  Sending does not block: the main thread must not wait for a client, and
+ *  the client is not going to be served anyway.
+ * \param conn connection to be closed
+ * \param response response to be sent
+ */
+static void rejectConnection(struct Connection * conn, const char * response)
+{
+	send(conn->fd, response, strlen(response), MSG_DONTWAIT | MSG_NOSIGNAL);
+	closeConnection(conn);
+}
+
+/** Receive data of a connection and queue it, if a request is complete
+ * \param server server state
+ * \param conn connection
+ */
+static void receive(struct Server * server, struct Connection * conn)
+{
+	ssize_t len = recv(conn->fd, conn->buffer + conn->len,
+		sizeof conn->buffer - conn->len, MSG_DONTWAIT);
+	if (len < 0 && (errno == EAGAIN || errno == EINTR)) {
+		if (!armConnection(server, conn, EPOLL_CTL_MOD))
+			closeConnection(conn);
+		return;
+	}
+	if (len <= 0) {
+		/* closed by the client or broken */
+		closeConnection(conn);
+		return;
+	}
+
+	conn->len += len;
+	if (memchr(conn->buffer + conn->len - len, '\n', len))
+		addJob(server, conn);
+	else if (conn->len == sizeof conn->buffer)
+		rejectConnection(conn, "Error: request too long\n\n");
+	else if (!armConnection(server, conn, EPOLL_CTL_MOD))
+		closeConnection(conn);
+}
+
+/** Serve queries on preloaded device trees over a Unix socket.
+ *  The blobs stay mapped and compiled queries are cached by their
+ *  expression. Requests are received by an epoll loop and processed by a
+ *  pool of worker threads, one for each online CPU.
+ * \param socketPath path of the socket
+ * \param filenames device trees to be preloaded
+ * \param count number of device trees
+ * \return exit code, only returns in case of an error
+ */
+int serveFdts(const char * socketPath, char * const * filenames, int count)
+{
+	struct Server * server = calloc(1, sizeof *server);
+	assert(server);
+	pthread_mutex_init(&server->cacheLock, NULL);
+	pthread_mutex_init(&server->jobLock, NULL);
+	pthread_cond_init(&server->jobCond, NULL);
+
+	/* preload the blobs */
+	server->count = count;
+	server->blobs = calloc(count, sizeof *server->blobs);
+	assert(server->blobs);
+	for (int i = 0; i < count; i++)
+		if (!openBlob(filenames[i], &server->blobs[i]))
+			return EXIT_FAILURE;
+
+	/* a client which went away must not kill the server */
+	signal(SIGPIPE, SIG_IGN);
+
+	struct sockaddr_un addr = {
+		.sun_family = AF_UNIX,
+	};
+	if (strlen(socketPath) >= sizeof addr.sun_path)
+		error(EXIT_FAILURE, 0, "Socket path '%s' too long", socketPath);
+	strcpy(addr.sun_path, socketPath);
+
+	/* replace a stale socket, but nothing else (e.g. a forgotten socket
+	 * argument would make the first device tree the socket path)
+	 */
+	struct stat st;
+	if (!lstat(socketPath, &st)) {
+		if (!S_ISSOCK(st.st_mode))
+			error(EXIT_FAILURE, 0, "'%s' exists and is not a socket",
+				socketPath);
+		if (unlink(socketPath) < 0)
+			error(EXIT_FAILURE, errno, "Could not remove '%s'", socketPath);
+	} else if (errno != ENOENT) {
+		error(EXIT_FAILURE, errno, "Could not stat '%s'", socketPath);
+	}
+
+	int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (listener < 0)
+		error(EXIT_FAILURE, errno, "Could not create socket");
+	if (bind(listener, (struct sockaddr *)&addr, sizeof addr) < 0)
+		error(EXIT_FAILURE, errno, "Could not bind to '%s'", socketPath);
+	if (listen(listener, SOMAXCONN) < 0)
+		error(EXIT_FAILURE, errno, "Could not listen on '%s'", socketPath);
+
+	server->epoll = epoll_create1(EPOLL_CLOEXEC);
+	if (server->epoll < 0)
+		error(EXIT_FAILURE, errno, "Could not create epoll instance");
+	struct epoll_event event = {
+		.events = EPOLLIN,
+		.data.ptr = NULL,
+	};
+	if (epoll_ctl(server->epoll, EPOLL_CTL_ADD, listener, &event) < 0)
+		error(EXIT_FAILURE, errno, "Could not watch socket");
+
+	/* start the worker pool */
+	long workers = sysconf(_SC_NPROCESSORS_ONLN);
+	if (workers < 1)
+		workers = 1;
+	for (long i = 0; i < workers; i++) {
+		pthread_t thread;
+		int err = pthread_create(&thread, NULL, worker, server);
+		if (err)
+			error(EXIT_FAILURE, err, "Could not start worker");
+		pthread_detach(thread);
+	}
+
+	struct epoll_event events[64];
+	while (true) {
+		int n = epoll_wait(server->epoll, events, 64, -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			error(EXIT_FAILURE, errno, "Could not wait for events");
+		}
+		for (int i = 0; i < n; i++) {
+			if (!events[i].data.ptr)
+				acceptConnection(server, listener);
+			else
+				receive(server, events[i].data.ptr);
+		}
+	}
+}
+
+/** Send a query to a server and print the response
+ * \param socketPath path of the server's socket
+ * \param filename device tree, as given to the server
+ * \param expr query expression
+ * \return exit code
+ */
+int queryServer(const char * socketPath, const char * filename,
+	const char * expr)
+{
+	struct sockaddr_un addr = {
+		.sun_family = AF_UNIX,
+	};
+	if (strlen(socketPath) >= sizeof addr.sun_path)
+		error(EXIT_FAILURE, 0, "Socket path '%s' too long", socketPath);
+	strcpy(addr.sun_path, socketPath);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		error(EXIT_FAILURE, errno, "Could not create socket");
+	if (connect(fd, (struct sockaddr *)&addr, sizeof addr) < 0)
+		error(EXIT_FAILURE, errno, "Could not connect to '%s'", socketPath);
+
+	FILE * stream = fdopen(fd, "r+");
+	if (!stream)
+		error(EXIT_FAILURE, errno, "Could not open stream");
+	fprintf(stream, "%s\t%s\n", filename, expr);
+	if (fflush(stream))
+		error(EXIT_FAILURE, errno, "Could not send request");
+
+	/* stream the response until the terminating empty line */
+	int ret = EXIT_SUCCESS;
+	char * line = NULL;
+	size_t size = 0;
+	bool first = true;
+	bool failed = false;
+	bool terminated = false;
+	while (getline(&line, &size, stream) > 0) {
+		if (!strcmp(line, "\n")) {
+			terminated = true;
+			break;
+		}
+		if (first && !strncmp(line, "Error: ", 7)) {
+			fputs(line + 7, stderr);
+			failed = true;
+			ret = EXIT_FAILURE;
+		} else if (failed) {
+			fputs(line, stderr);
+		} else {
+			fputs(line, stdout);
+		}
+		first = false;
+	}
+
+	/* without the terminator, the response may be incomplete */
+	if (!terminated) {
+		error(0, 0, "Connection to '%s' closed before the end of the "
+			"response", socketPath);
+		ret = EXIT_FAILURE;
+	}
+
+	free(line);
+	fclose(stream);
+	return ret;
+}
@@ -0,0 +1,9 @@
+#ifndef _SERVE_H
+#define _SERVE_H
+
+int serveFdts(const char * socketPath, char * const * filenames, int count);
+
+int queryServer(const char * socketPath, const char * filename,
+	const char * expr);
+
+#endif
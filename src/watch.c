@@ -0,0 +1,356 @@
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <watch.h>
+#include <blob.h>
+#include <hash.h>
+#include <query.h>
+#include <parser.h>
+
+#include <sys/inotify.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <assert.h>
+#include <errno.h>
+#include <error.h>
+#include <libfdt.h>
+
+/** Set of paths, i.e. a hash table with open addressing */
+struct PathSet {
+	/** slots: NULL if empty, tombstone if deleted, a path otherwise */
+	char ** slots;
+	/** number of slots, always a power of two */
+	size_t size;
+	/** number of used slots, including tombstones */
+	size_t used;
+};
+
+/** Marker of a deleted slot */
+static char tombstone[1];
+
+/** Find the slot of a path
+ * \param set path set
+ * \param path path, not necessarily terminated
+ * \param len length of the path
+ * \param insert true to return the first free slot if the path is missing
+ * \return slot or NULL if the path is missing and insert is false
+ */
+static char ** findPath(const struct PathSet * set, const char * path,
+	size_t len, bool insert)
+{
+	char ** freeSlot = NULL;
+	size_t mask = set->size - 1;
+	for (size_t i = hashBytes(HASH_SEED, path, len) & mask; ;
+		i = (i + 1) & mask) {
+		char * slot = set->slots[i];
+		if (!slot)
+			return insert ? (freeSlot ? freeSlot : &set->slots[i]) : NULL;
+		if (slot == tombstone) {
+			if (!freeSlot)
+				freeSlot = &set->slots[i];
+		} else if (!strncmp(slot, path, len) && !slot[len]) {
+			return &set->slots[i];
+		}
+	}
+}
+
+/** Test whether a path is in a set
+ * \param set path set
+ * \param path path, not necessarily terminated
+ * \param len length of the path
+ * \return true if the path is in the set
+ */
+static bool containsPath(const struct PathSet * set, const char * path,
+	size_t len)
+{
+	return findPath(set, path, len, false) != NULL;
+}
+
+/** Add a path to a set, which does not contain it yet
+ * \param set path set
+ * \param path path, not necessarily terminated
+ * \param len length of the path
+ */
+static void addPath(struct PathSet * set, const char * path, size_t len)
+{
+	/* keep the load factor below 1/2 */
+	if (2 * (set->used + 1) > set->size) {
+		struct PathSet grown = {
+			.size = set->size * 2,
+		};
+		grown.slots = calloc(grown.size, sizeof *grown.slots);
+		assert(grown.slots);
+		for (size_t i = 0; i < set->size; i++) {
+			char * slot = set->slots[i];
+			if (slot && slot != tombstone) {
+				*findPath(&grown, slot, strlen(slot), true) = slot;
+				grown.used++;
+			}
+		}
+		free(set->slots);
+		*set = grown;
+	}
+
+	char ** slot = findPath(set, path, len, true);
+	if (!*slot)
+		set->used++;
+	*slot = strndup(path, len);
+	assert(*slot);
+}
+
+/** Remove a path from a set, which contains it
+ * \param set path set
+ * \param path path, not necessarily terminated
+ * \param len length of the path
+ */
+static void removePath(struct PathSet * set, const char * path, size_t len)
+{
+	char ** slot = findPath(set, path, len, false);
+	assert(slot);
+	free(*slot);
+	*slot = tombstone;
+}
+
+/** A watched query */
+struct WatchedQuery {
+	/** expression, for the output */
+	const char * expr;
+	/** compiled query */
+	struct NodeTest * test;
+	/** paths of the nodes currently satisfying the query */
+	struct PathSet matches;
+};
+
+/** State of the watch mode */
+struct Watch {
+	/** watched queries */
+	struct WatchedQuery * queries;
+	/** number of watched queries */
+	int count;
+	/** currently mapped blob */
+	struct Blob blob;
+	/** hashes of the currently mapped blob */
+	struct HashedFdt hashed;
+	/** during an update: hashes of the new blob */
+	struct HashedFdt update;
+	/** during an update: nodes of the new blob which have a partner */
+	bool * paired;
+	/** offsets of the nodes from the root node to the current one */
+	int * chain;
+	/** size of the chain */
+	int chainSize;
+	/** path of the current node */
+	char path[PATH_MAX];
+};
+
+/** Re-evaluate the queries for a node and report changed matches
+ * \param watch watch state
+ * \param indexNew index of the node in the new blob, -1 if it was removed
+ * \param depth depth of the node
+ * \param len length of the path of the node
+ */
+static void updateMatches(struct Watch * watch, int indexNew, int depth,
+	size_t len)
+{
+	for (int i = 0; i < watch->count; i++) {
+		struct WatchedQuery * query = &watch->queries[i];
+		bool matched = containsPath(&query->matches, watch->path, len);
+		bool matches = indexNew >= 0 && queryMatchesNode(watch->update.fdt,
+			watch->chain, depth, query->test);
+		if (matches == matched)
+			continue;
+		printf("%c %s: %.*s\n", matches ? '+' : '-', query->expr, (int)len,
+			watch->path);
+		if (matches)
+			addPath(&query->matches, watch->path, len);
+		else
+			removePath(&query->matches, watch->path, len);
+	}
+}
+
+/** Re-evaluate the queries for a subtree which has changed.
+ *  Subtrees which are identical in both blobs and whose ancestors have the
+ *  same properties in both blobs are skipped, because the queries give the
+ *  same results for them.
+ * \param watch watch state
+ * \param indexOld index of the node in the old blob, -1 if it was added
+ * \param indexNew index of the node in the new blob, -1 if it was removed
+ * \param depth depth of the node
+ * \param len length of the path of the node
+ * \param ancestorsSame true if all ancestors have the same properties
+ */
+static void updateSubtree(struct Watch * watch, int indexOld, int indexNew,
+	int depth, size_t len, bool ancestorsSame)
+{
+	const struct HashedNode * nodeOld =
+		indexOld >= 0 ? &watch->hashed.nodes[indexOld] : NULL;
+	const struct HashedNode * nodeNew =
+		indexNew >= 0 ? &watch->update.nodes[indexNew] : NULL;
+
+	if (nodeOld && nodeNew && ancestorsSame && nodeOld->hash == nodeNew->hash)
+		return;
+
+	if (nodeNew) {
+		if (depth == watch->chainSize) {
+			watch->chainSize *= 2;
+			watch->chain = realloc(watch->chain,
+				watch->chainSize * sizeof *watch->chain);
+			assert(watch->chain);
+		}
+		watch->chain[depth] = nodeNew->offset;
+	}
+
+	updateMatches(watch, indexNew, depth, len);
+
+	ancestorsSame = ancestorsSame && nodeOld && nodeNew &&
+		nodeOld->properties == nodeNew->properties;
+
+	/* pair the children by name */
+	int slot = nodeNew ? nodeNew->firstChild : -1;
+	for (int childOld = nodeOld ? nodeOld->firstChild : -1; childOld >= 0;
+		childOld = watch->hashed.nodes[childOld].nextSibling) {
+		int childNew = -1;
+		if (nodeNew) {
+			childNew = pairHashedChild(&watch->hashed, childOld,
+				&watch->update, indexNew, slot, watch->paired);
+			if (slot >= 0)
+				slot = watch->update.nodes[slot].nextSibling;
+			if (childNew >= 0)
+				watch->paired[childNew] = true;
+		}
+		size_t childLen = appendHashedName(&watch->hashed, childOld,
+			watch->path, len, sizeof watch->path);
+		updateSubtree(watch, childOld, childNew, depth + 1, childLen,
+			ancestorsSame);
+	}
+
+	/* added children */
+	for (int childNew = nodeNew ? nodeNew->firstChild : -1; childNew >= 0;
+		childNew = watch->update.nodes[childNew].nextSibling) {
+		if (watch->paired[childNew])
+			continue;
+		size_t childLen = appendHashedName(&watch->update, childNew,
+			watch->path, len, sizeof watch->path);
+		updateSubtree(watch, -1, childNew, depth + 1, childLen, false);
+	}
+}
+
+/** Load the watched file and report the changed matches
+ * \param watch watch state
+ * \param filename watched file
+ */
+static void reload(struct Watch * watch, const char * filename)
+{
+	/* the file might be incomplete: just wait for the next change.
+	 * The file is copied rather than mapped, as a mapping would follow a
+	 * rewrite in place: the old tree would change under our feet (or fault
+	 * if the file shrinks) while it is still compared to the new one.
+	 */
+	struct Blob blob;
+	if (!loadBlob(filename, &blob))
+		return;
+	if (!hashFdt(blob.fdt, &watch->update)) {
+		error(0, 0, "FDT invalid: malformed structure block");
+		closeBlob(&blob);
+		return;
+	}
+
+	watch->paired = calloc(watch->update.count, sizeof *watch->paired);
+	assert(watch->paired);
+
+	strcpy(watch->path, "/");
+	updateSubtree(watch, watch->hashed.count ? 0 : -1, 0, 0, 1, true);
+	fflush(stdout);
+
+	free(watch->paired);
+	if (watch->hashed.count) {
+		freeHashedFdt(&watch->hashed);
+		closeBlob(&watch->blob);
+	}
+	watch->hashed = watch->update;
+	watch->blob = blob;
+}
+
+/** Watch a device tree file and report whenever the set of nodes satisfying
+ *  one of the queries changes. Initially, all matching nodes are reported as
+ *  added. Only the subtrees which changed are evaluated again.
+ *  Each version of the file is read into a private buffer, watch mode never
+ *  keeps a file-backed mapping.
+ * \param filename file to be watched
+ * \param exprs query expressions
+ * \param count number of query expressions
+ * \return exit code, only returns in case of an error
+ */
+int watchFdt(const char * filename, char * const * exprs, int count)
+{
+	struct Watch watch = {
+		.count = count,
+		.chainSize = 16,
+	};
+
+	/* compile the queries once */
+	watch.queries = calloc(count, sizeof *watch.queries);
+	assert(watch.queries);
+	for (int i = 0; i < count; i++) {
+		struct WatchedQuery * query = &watch.queries[i];
+		query->expr = exprs[i];
+		query->test = parseNodeTestExpr(exprs[i]);
+		if (!query->test)
+			return EXIT_FAILURE;
+		query->matches.size = 16;
+		query->matches.slots = calloc(query->matches.size,
+			sizeof *query->matches.slots);
+		assert(query->matches.slots);
+	}
+	watch.chain = malloc(watch.chainSize * sizeof *watch.chain);
+	assert(watch.chain);
+
+	/* files are usually replaced rather than rewritten: watch the directory
+	 * and filter the events by name
+	 */
+	char * dirCopy = strdup(filename);
+	char * baseCopy = strdup(filename);
+	assert(dirCopy && baseCopy);
+	const char * dir = dirname(dirCopy);
+	const char * base = basename(baseCopy);
+
+	int fd = inotify_init1(IN_CLOEXEC);
+	if (fd < 0)
+		error(EXIT_FAILURE, errno, "Could not initialize inotify");
+	if (inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+		error(EXIT_FAILURE, errno, "Could not watch '%s'", dir);
+
+	reload(&watch, filename);
+
+	char buffer[4096]
+		__attribute__ ((aligned(__alignof__(struct inotify_event))));
+	while (true) {
+		ssize_t len = read(fd, buffer, sizeof buffer);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			error(EXIT_FAILURE, errno, "Could not read inotify events");
+		}
+
+		/* reload at most once for a batch of events */
+		bool changed = false;
+		for (char * ptr = buffer; ptr < buffer + len; ) {
+			const struct inotify_event * event = (void *)ptr;
+			if (event->len && !strcmp(event->name, base))
+				changed = true;
+			/* events were dropped: one of them might have been ours */
+			if (event->mask & IN_Q_OVERFLOW)
+				changed = true;
+			ptr += sizeof *event + event->len;
+		}
+		if (changed)
+			reload(&watch, filename);
+	}
+}
@@ -0,0 +1,6 @@
+#ifndef _WATCH_H
+#define _WATCH_H
+
+int watchFdt(const char * filename, char * const * exprs, int count);
+
+#endif